@@ -4,6 +4,7 @@
  * Compatible with NS-3.33
  * STA1: Static position (5m from AP1)
  * STA2: Dynamic movement (5m -> 20m -> 10m from AP2)
+ * Larger N-AP x M-STA topologies: --numAps, --stasPerAp, --placement=grid|hex
  * created by rahman
  */
 #include "ns3/core-module.h"
@@ -16,13 +17,36 @@
 #include "ns3/internet-module.h"
 #include "ns3/netanim-module.h"
 #include "ns3/flow-monitor-module.h"
+#include "ns3/energy-module.h"
 #include <iomanip>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <cstdint>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <chrono>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#ifdef FTM_WITH_ONNXRUNTIME
+#include <onnxruntime_cxx_api.h>
+#endif
+#ifdef NS3_MPI
+#include "ns3/mpi-module.h"
+#endif
 
 using namespace ns3;
 
@@ -32,264 +56,3657 @@ NS_LOG_COMPONENT_DEFINE("FTMAdaptiveWiFi");
 FlowMonitorHelper flowmonHelper;
 Ptr<FlowMonitor> monitor;
 Ptr<Ipv4FlowClassifier> classifier;
-std::ofstream csvOutput;
+std::string outputDir = "result";   // every output file goes here
+std::string metricsFormat = "csv"; // csv | binary
+std::string flowmonOutput = "xml";  // xml | xml-compact | jsonl | none
+double flowmonStreamInterval = 1.0; // s between jsonl snapshots
+double rolloverInterval = 0.0;      // s, > 0: roll output files over and summarize each window
+uint32_t outputPart = 0;            // index of the current output part
 
-// Tracking variables
-std::map<FlowId, uint64_t> lastRxBytes;
-std::map<FlowId, uint64_t> lastTxPackets;
-std::map<FlowId, uint64_t> lastRxPackets;
-std::map<FlowId, Time> lastDelaySum;
+// NetAnim: off by default for headless batch runs
+bool netanim = false;
+bool netanimPositionsOnly = false; // skip packet tracing and metadata
+double netanimPollInterval = 0.25; // s between node position samples
 
-// AP and STA nodes for distance calculation
-Ptr<Node> apNode1;
-Ptr<Node> apNode2;
-Ptr<Node> staNode1;
-Ptr<Node> staNode2;
+// Packet capture: off by default so sweeps pay no PCAP I/O
+std::string pcapMode = "off";      // off | full | header
+uint32_t pcapSnaplen = 128;        // bytes kept per frame in header mode
+std::string pcapWindows = "";      // "start-stop,..." in seconds, empty = whole run
+std::string pcapAps = "";          // "1,3,..." AP numbers, empty = all APs
+uint32_t metricsBufferKb = 1024;    // sink buffer size before a flush
 
-// Current TX power for adaptive control
-double currentTxPower1 = 16.0; // dBm
-double currentTxPower2 = 16.0; // dBm
+// Per-flow packet counters, used both as FlowMonitor state at the previous
+// sample and as per-interval accumulators for the trace collector
+struct FlowCounters
+{
+    FlowCounters() : rxBytes(0), txPackets(0), rxPackets(0) {}
+    uint64_t rxBytes;
+    uint64_t txPackets;
+    uint64_t rxPackets;
+    Time delaySum;
+};
+
+// Metrics collector: "flowmon" polls FlowMonitor every sample, "trace"
+// counts packets from the client Tx / sink Rx traces as they happen, "ap"
+// counts deliveries at the AP IP layer (wireless hop only; needed when the
+// server runs in another logical process)
+std::string collector = "flowmon";
+
+// Distributed run: BSS groups and the router/server backbone in separate
+// MPI logical processes (needs an ns-3 build with --enable-mpi)
+bool partition = false;
+uint32_t systemId = 0;    // this logical process
+uint32_t systemCount = 1; // logical processes in the run
+
+// Tracking variables: FlowMonitor counters seen at the previous sample,
+// indexed by FlowId (FlowIds are small sequential integers). A flow that has
+// not been sampled yet starts from zero, so its first delta is its running total.
+std::vector<FlowCounters> lastFlowState;
+
+// Trace collector: counters accumulated since the previous sample, indexed
+// by STA id, plus the STAs touched in this interval
+std::vector<FlowCounters> intervalCounters;
+std::vector<uint8_t> intervalDirty;
+std::vector<uint32_t> dirtyStations;
+std::vector<FlowCounters> runCounters; // run totals for the summary when FlowMonitor is off
+
+// IPv4 header (20 B) + UDP header (8 B), added so trace-collector byte
+// counts match the IP-level bytes FlowMonitor reports
+const uint32_t ipUdpOverhead = 28;
+
+// Metrics sampling (can be changed while the simulation runs)
+double simTime = 20.0;           // s, clients stop and the last sample is taken here
+double trafficEnd = 20.0;        // s, end of the last episode (simTime unless --warmRuns)
+double sampleInterval = 1.0;     // s between RecordMetrics calls
+bool adaptiveSampling = false;   // sample faster while a mobile STA is moving
+double fastSampleInterval = 0.1; // s, used by adaptive sampling while moving
+double movingSpeed = 0.1;        // m/s above which a STA counts as moving
+Time lastSampleTime;
+
+// Traffic and controller parameters (sweepable from the command line)
+std::string dataRate = "5Mbps";  // per-STA OnOff rate
+uint32_t packetSize = 1024;      // bytes
+double mobileExcursion = 15.0;   // m, farthest point of the mobile STA path
+
+struct ControllerThresholds
+{
+    double targetThroughput; // Mbps, 90% of the 5Mbps offered load
+    double farDistance;      // m
+    double midDistance;      // m
+    double nearDistance;     // m
+    double weakRssi;         // dBm
+    double midRssi;          // dBm
+    double strongRssi;       // dBm
+};
+ControllerThresholds thresholds = {4.5, 15.0, 10.0, 7.0, -65.0, -60.0, -50.0};
+
+// Topology configuration (defaults reproduce the original 2-AP/2-STA scenario)
+uint32_t numAps = 2;
+uint32_t stasPerAp = 1;
+std::string placement = "grid"; // grid | hex
+double apSpacing = 20.0;         // m between neighbouring APs
+double staDistance = 5.0;        // m between a STA and its AP
+double initialTxPower = 16.0;    // dBm
+const double maxTxPower = 20.0;  // dBm, controller ceiling
+const double minTxPower = 10.0;  // dBm, controller floor
+
+// Channel plan
+std::string channelMode = "isolated"; // isolated (own channel object per BSS) | shared (co-channel interference)
+std::string channels = "36";          // 5 GHz channel numbers, assigned round-robin to the APs
+double channelDwell = 5.0;            // s an AP stays on a channel before it may switch again
+std::vector<uint8_t> channelPool;
+
+// 5 GHz 20 MHz channels of the WifiPhy channel table (UNII-1/2/2e/3)
+bool Is5GhzChannel(int number)
+{
+    return (number >= 36 && number <= 64 && number % 4 == 0) ||
+           (number >= 100 && number <= 144 && number % 4 == 0) ||
+           (number >= 149 && number <= 165 && number % 4 == 1);
+}
+
+// Per-BSS state, indexed by AP id
+struct BssState
+{
+    Ptr<Node> apNode;
+    NetDeviceContainer apDevice;
+    NetDeviceContainer staDevices;
+    NetDeviceContainer p2pDevices;
+    Ptr<WifiPhy> apPhy; // runtime power control target
+    uint32_t firstSta;  // index of the first STA of this BSS in 'stations'
+    double txPower;     // current TX power for adaptive control (dBm)
+    bool mobile;        // STAs follow the waypoint pattern and run the controller
+    uint8_t channel;    // current channel number
+    Time lastChannelSwitch;
+    uint32_t channelSwitches;
+    Time lastActuation;   // last controller change of power or channel
+    uint32_t actuations;  // controller changes in the current run
+    uint64_t boostTick;   // control tick of the last step-up request (0 = none)
+    double boostNetwork;  // network throughput at that tick (Mbps)
+};
+std::vector<BssState> bss;
+
+// Per-STA state, indexed by global STA id (AP id * stasPerAp + local index)
+struct StaState
+{
+    Ptr<Node> node;
+    uint32_t ap;
+    std::string label; // flow label, e.g. "AP2-STA2"
+};
+std::vector<StaState> stations;
+std::vector<uint32_t> mobileStations; // STA ids that follow waypoints
+
+// Source address (Ipv4Address::Get()) -> STA id, filled once addresses are assigned
+std::unordered_map<uint32_t, uint32_t> staByAddress;
+
+// FlowId -> {AP, STA, pair label}, resolved once when the flow first appears
+struct FlowRecord
+{
+    FlowRecord() : resolved(false), tracked(false), sta(0), ap(0) {}
+    bool resolved;
+    bool tracked;       // uplink STA -> server flow
+    uint32_t sta;
+    uint32_t ap;
+    std::string label;  // e.g. "AP2-STA2"
+};
+std::vector<FlowRecord> flowRegistry; // indexed by FlowId
+
+// ============== Helper Functions ==============
+void CreateResultFolder()
+{
+    // Create every component of outputDir (e.g. sweep/run-00001)
+    struct stat info;
+    for (size_t pos = outputDir.find('/', 1); ; pos = outputDir.find('/', pos + 1)) {
+        std::string dir = outputDir.substr(0, pos);
+        if (!dir.empty() && stat(dir.c_str(), &info) != 0) {
+            mkdir(dir.c_str(), 0755);
+        }
+        if (pos == std::string::npos) {
+            break;
+        }
+    }
+}
+
+std::string OutputPath(const std::string &name)
+{
+    return outputDir + "/" + name;
+}
+
+// "base.ext", or "base-00003.ext" once output rolls over into parts
+std::string PartName(const std::string &base, const std::string &ext)
+{
+    if (rolloverInterval <= 0) {
+        return base + "." + ext;
+    }
+    char part[16];
+    std::snprintf(part, sizeof(part), "-%05u.", outputPart);
+    return base + part + ext;
+}
+
+std::vector<std::string> SplitList(const std::string &list, char separator)
+{
+    std::vector<std::string> items;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, separator)) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+Vector ApPosition(uint32_t ap)
+{
+    // APs fill columns of 'side' rows starting at (20, 20), so the default
+    // two APs land at (20, 20) and (20, 40) like the original layout
+    uint32_t side = (uint32_t)std::ceil(std::sqrt((double)numAps));
+    uint32_t col = ap / side;
+    uint32_t row = ap % side;
+    if (placement == "hex") {
+        // Offset every other column by half a spacing (hexagonal cells)
+        double x = 20.0 + col * apSpacing * std::sqrt(3.0) / 2.0;
+        double y = 20.0 + row * apSpacing + ((col % 2) ? apSpacing / 2.0 : 0.0);
+        return Vector(x, y, 0);
+    }
+    return Vector(20.0 + col * apSpacing, 20.0 + row * apSpacing, 0);
+}
+
+// Direction of a STA as seen from its AP; STA 0 sits east of the AP
+double StaAngle(uint32_t localSta)
+{
+    return 2.0 * M_PI * localSta / stasPerAp;
+}
+
+std::string FlowLabel(uint32_t sta)
+{
+    std::ostringstream oss;
+    oss << "AP" << stations[sta].ap + 1 << "-STA" << sta + 1;
+    return oss.str();
+}
+
+const FlowRecord &LookupFlow(FlowId fid)
+{
+    if (fid >= flowRegistry.size()) {
+        flowRegistry.resize(fid + 1);
+    }
+    FlowRecord &record = flowRegistry[fid];
+    if (!record.resolved) {
+        // FindFlow and the address lookup only run for new flows
+        record.resolved = true;
+        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(fid);
+        std::unordered_map<uint32_t, uint32_t>::const_iterator staIt = staByAddress.find(t.sourceAddress.Get());
+        if (staIt != staByAddress.end()) {
+            record.tracked = true;
+            record.sta = staIt->second;
+            record.ap = stations[record.sta].ap;
+            record.label = stations[record.sta].label;
+        }
+    }
+    return record;
+}
+
+bool Distributed()
+{
+    return systemCount > 1;
+}
+
+// Logical process of a BSS: the backbone keeps 0, BSSs round-robin over the rest
+uint32_t BssSystemId(uint32_t ap)
+{
+    return Distributed() ? 1 + ap % (systemCount - 1) : 0;
+}
+
+bool IsLocal(Ptr<Node> node)
+{
+    return node->GetSystemId() == systemId;
+}
+
+double CalculateDistance(Ptr<Node> node1, Ptr<Node> node2)
+{
+    Ptr<MobilityModel> mob1 = node1->GetObject<MobilityModel>();
+    Ptr<MobilityModel> mob2 = node2->GetObject<MobilityModel>();
+    return mob1->GetDistanceFrom(mob2);
+}
+
+double CalculateRSSI(double distance, double txPower)
+{
+    // Friis propagation model at 5GHz
+    double frequency = 5.0; // GHz
+    double pathLoss = 20 * log10(distance) + 20 * log10(frequency) + 32.44;
+    return txPower - pathLoss;
+}
+
+// ============== Link Geometry ==============
+// Node positions are copied into flat per-axis arrays once per control tick
+// and the AP-STA distances and path losses are computed from them in plain
+// loops over contiguous doubles, which the compiler vectorizes, instead of
+// a GetObject<MobilityModel>() lookup per pair. The serving links are always
+// computed; the full AP x STA matrix (interferers included) only when the
+// joint coordinator needs it. The path loss is the channel's
+// LogDistancePropagationLossModel with the same parameters, so analytic
+// estimates match what the PHY sees.
+double pathLossExponent = 3.0;
+double referenceDistance = 1.0;  // m
+double referenceLoss = 46.6777;  // dB at referenceDistance (ns-3 default: Friis at 5.15 GHz)
+
+struct LinkGeometry
+{
+    LinkGeometry() : time(-1.0), allPairs(false) {}
+    std::vector<Ptr<MobilityModel> > apMobility;
+    std::vector<Ptr<MobilityModel> > staMobility;
+    std::vector<double> apX, apY, apZ;     // by AP id
+    std::vector<double> staX, staY, staZ;  // by STA id
+    std::vector<double> serving;           // distance to the own AP (m), by STA id
+    std::vector<double> servingLoss;       // path loss to the own AP (dB), by STA id
+    std::vector<double> distance;          // [ap * stations + sta], allPairs only
+    std::vector<double> pathLoss;          // dB, same layout
+    double time;                           // sim time of the cached tick
+    bool allPairs;
+};
+LinkGeometry geometry;
+
+// d[k] = |p[k] - origin|, the same arithmetic as ns3::CalculateDistance.
+// Squares and sqrt run as separate loops: the first vectorizes at -O2/-O3,
+// the second (sqrt may set errno) under -fno-math-errno
+void RowDistances(const double *x, const double *y, const double *z, double ox, double oy, double oz,
+                  double *d, uint32_t n)
+{
+    for (uint32_t k = 0; k < n; ++k) {
+        double dx = x[k] - ox;
+        double dy = y[k] - oy;
+        double dz = z[k] - oz;
+        d[k] = dx * dx + dy * dy + dz * dz;
+    }
+    for (uint32_t k = 0; k < n; ++k) {
+        d[k] = std::sqrt(d[k]);
+    }
+}
+
+// LogDistancePropagationLossModel: the reference loss inside the reference distance.
+// The log10 loop vectorizes only with a vector math library (-ffast-math, glibc libmvec)
+void RowPathLoss(const double *d, double *loss, uint32_t n)
+{
+    double slope = 10.0 * pathLossExponent;
+    for (uint32_t k = 0; k < n; ++k) {
+        double ratio = std::max(d[k], referenceDistance) / referenceDistance;
+        loss[k] = referenceLoss + slope * std::log10(ratio);
+    }
+}
+
+void RefreshLinkGeometry(bool allPairs)
+{
+    double now = Simulator::Now().GetSeconds();
+    if (geometry.time == now && (geometry.allPairs || !allPairs)) {
+        return;
+    }
+    uint32_t numStas = stations.size();
+    if (geometry.staMobility.empty()) {
+        geometry.apMobility.resize(numAps);
+        for (uint32_t i = 0; i < numAps; ++i) {
+            geometry.apMobility[i] = bss[i].apNode->GetObject<MobilityModel>();
+        }
+        geometry.staMobility.resize(numStas);
+        for (uint32_t k = 0; k < numStas; ++k) {
+            geometry.staMobility[k] = stations[k].node->GetObject<MobilityModel>();
+        }
+        geometry.apX.resize(numAps);
+        geometry.apY.resize(numAps);
+        geometry.apZ.resize(numAps);
+        geometry.staX.resize(numStas);
+        geometry.staY.resize(numStas);
+        geometry.staZ.resize(numStas);
+        geometry.serving.resize(numStas);
+        geometry.servingLoss.resize(numStas);
+    }
+    for (uint32_t i = 0; i < numAps; ++i) {
+        Vector p = geometry.apMobility[i]->GetPosition();
+        geometry.apX[i] = p.x;
+        geometry.apY[i] = p.y;
+        geometry.apZ[i] = p.z;
+    }
+    for (uint32_t k = 0; k < numStas; ++k) {
+        Vector p = geometry.staMobility[k]->GetPosition();
+        geometry.staX[k] = p.x;
+        geometry.staY[k] = p.y;
+        geometry.staZ[k] = p.z;
+    }
+    
+    // A BSS's STAs are contiguous, so each serving row is one AP against a slice
+    for (uint32_t i = 0; i < numAps; ++i) {
+        uint32_t first = bss[i].firstSta;
+        RowDistances(&geometry.staX[first], &geometry.staY[first], &geometry.staZ[first],
+                     geometry.apX[i], geometry.apY[i], geometry.apZ[i],
+                     &geometry.serving[first], bss[i].staDevices.GetN());
+    }
+    RowPathLoss(geometry.serving.data(), geometry.servingLoss.data(), numStas);
+    
+    if (allPairs) {
+        geometry.distance.resize((size_t)numAps * numStas);
+        geometry.pathLoss.resize((size_t)numAps * numStas);
+        for (uint32_t i = 0; i < numAps; ++i) {
+            RowDistances(geometry.staX.data(), geometry.staY.data(), geometry.staZ.data(),
+                         geometry.apX[i], geometry.apY[i], geometry.apZ[i],
+                         &geometry.distance[(size_t)i * numStas], numStas);
+        }
+        RowPathLoss(geometry.distance.data(), geometry.pathLoss.data(), numAps * numStas);
+    }
+    geometry.time = now;
+    geometry.allPairs = allPairs;
+}
+
+// ============== Profiling ==============
+// Wall-clock instrumentation written to ftm_profile.json, so simulator
+// throughput can be tracked across model changes
+typedef std::chrono::steady_clock ProfileClock;
+
+struct ProfileCounter
+{
+    double seconds;
+    uint64_t calls;
+};
+ProfileCounter recordMetricsProfile = {0.0, 0}; // whole RecordMetrics tick
+ProfileCounter decisionProfile = {0.0, 0};      // policy DecideBatch only
+
+double SecondsBetween(ProfileClock::time_point start, ProfileClock::time_point end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Adds the lifetime of the scope to a counter
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileCounter &counter) : m_counter(counter), m_start(ProfileClock::now()) {}
+    ~ProfileScope()
+    {
+        m_counter.seconds += SecondsBetween(m_start, ProfileClock::now());
+        m_counter.calls++;
+    }
+    
+private:
+    ProfileCounter &m_counter;
+    ProfileClock::time_point m_start;
+};
+
+// ============== AI Power Control ==============
+enum PowerAction
+{
+    ACTION_MAINTAIN = 0,
+    ACTION_INCREASE_POWER,
+    ACTION_DECREASE_POWER,
+    ACTION_INCREASE_POWER_CHANGE_CHANNEL,
+    NUM_POWER_ACTIONS
+};
+
+// Names written to the AI_Decision column, indexed by PowerAction
+const char *powerActionNames[NUM_POWER_ACTIONS] = {
+    "maintain", "increase_power", "decrease_power", "increase_power_change_channel"
+};
+
+// What a policy sees for one AP-STA link at a control tick
+struct LinkObservation
+{
+    uint32_t ap;
+    uint32_t sta;
+    double distance;   // m
+    double throughput; // Mbps
+    double pdr;        // %
+    double delay;      // ms
+    double rssi;       // dBm
+    double txPower;    // dBm
+    double networkThroughput; // Mbps, all flows of this tick
+};
+
+class IPowerPolicy
+{
+public:
+    virtual ~IPowerPolicy() {}
+    virtual PowerAction Decide(const LinkObservation &obs) const = 0;
+    
+    // Score every link of a control tick at once; model backends override
+    // this to run a single batched inference
+    virtual void DecideBatch(const std::vector<LinkObservation> &obs,
+                             std::vector<PowerAction> &actions) const
+    {
+        actions.resize(obs.size());
+        for (size_t i = 0; i < obs.size(); ++i) {
+            actions[i] = Decide(obs[i]);
+        }
+    }
+};
+
+// Model input features, in the order ONNX models receive them
+enum ObservationFeature
+{
+    FEATURE_DISTANCE = 0,
+    FEATURE_RSSI,
+    FEATURE_THROUGHPUT,
+    FEATURE_PDR,
+    FEATURE_DELAY,
+    FEATURE_TX_POWER,
+    NUM_FEATURES
+};
+
+const char *featureNames[NUM_FEATURES] = {
+    "distance", "rssi", "throughput", "pdr", "delay", "txPower"
+};
+
+float FeatureValue(const LinkObservation &obs, uint32_t feature)
+{
+    switch (feature) {
+        case FEATURE_DISTANCE: return obs.distance;
+        case FEATURE_RSSI: return obs.rssi;
+        case FEATURE_THROUGHPUT: return obs.throughput;
+        case FEATURE_PDR: return obs.pdr;
+        case FEATURE_DELAY: return obs.delay;
+        default: return obs.txPower;
+    }
+}
+
+// Index of the largest of NUM_POWER_ACTIONS scores
+PowerAction ArgMaxAction(const float *scores)
+{
+    uint32_t best = 0;
+    for (uint32_t a = 1; a < NUM_POWER_ACTIONS; ++a) {
+        if (scores[a] > scores[best]) {
+            best = a;
+        }
+    }
+    return (PowerAction)best;
+}
+
+// The original hand-written rules, with configurable thresholds
+class ThresholdPowerPolicy : public IPowerPolicy
+{
+public:
+    // channelSwitch: ask for a channel change once power is already maxed out
+    explicit ThresholdPowerPolicy(const ControllerThresholds &t, bool channelSwitch = false)
+        : m_t(t), m_channelSwitch(channelSwitch) {}
+    
+    PowerAction Decide(const LinkObservation &obs) const
+    {
+        // CRITICAL: Check distance and RSSI first (most important)
+        if (obs.distance > m_t.farDistance || obs.rssi < m_t.weakRssi) {
+            return Boost(obs); // Far distance or weak signal
+        } 
+        else if (obs.distance > m_t.midDistance || obs.rssi < m_t.midRssi) {
+            if (obs.throughput < m_t.targetThroughput * 0.9) {
+                return Boost(obs); // Medium distance with degraded throughput
+            }
+        } 
+        else if (obs.distance < m_t.nearDistance && obs.rssi > m_t.strongRssi &&
+                 obs.throughput > m_t.targetThroughput) {
+            return ACTION_DECREASE_POWER; // Very close with excellent signal - save energy
+        }
+        return ACTION_MAINTAIN;
+    }
+    
+    // The rule parameters in bridge order: targetThroughput, far/mid/near
+    // distance, weak/mid/strong RSSI, maxTxPower, channelSwitch
+    void PublishRules(double *rules) const
+    {
+        double values[] = {m_t.targetThroughput, m_t.farDistance, m_t.midDistance, m_t.nearDistance,
+                           m_t.weakRssi, m_t.midRssi, m_t.strongRssi, maxTxPower,
+                           m_channelSwitch ? 1.0 : 0.0};
+        std::copy(values, values + sizeof(values) / sizeof(values[0]), rules);
+    }
+    
+private:
+    PowerAction Boost(const LinkObservation &obs) const
+    {
+        if (m_channelSwitch && obs.txPower >= maxTxPower) {
+            return ACTION_INCREASE_POWER_CHANGE_CHANNEL;
+        }
+        return ACTION_INCREASE_POWER;
+    }
+    
+    ControllerThresholds m_t;
+    bool m_channelSwitch;
+};
+
+// Precomputed action per quantized (distance, RSSI, throughput) bin, so a
+// decision is three clamps and one array read. The table is either compiled
+// from another policy evaluated at the bin centres or loaded from a text file:
+//   distance <min> <max> <bins>
+//   rssi <min> <max> <bins>
+//   throughput <min> <max> <bins>
+//   <distance*rssi*throughput action codes, throughput fastest>
+// Lines starting with '#' are comments. The table has no TX power axis: with
+// channelSwitch an increase_power at full power becomes
+// increase_power_change_channel after the lookup, as in the threshold rules.
+class LookupTablePowerPolicy : public IPowerPolicy
+{
+public:
+    struct Axis
+    {
+        double min;
+        double max;
+        uint32_t bins;
+        
+        // Clamped before the cast; NaN (a value never computed) lands in bin 0
+        uint32_t Index(double value) const
+        {
+            double pos = (value - min) / (max - min) * bins;
+            if (!(pos > 0)) {
+                return 0;
+            }
+            if (pos >= bins - 1) {
+                return bins - 1;
+            }
+            return (uint32_t)pos;
+        }
+        
+        double Center(uint32_t index) const
+        {
+            return min + (index + 0.5) * (max - min) / bins;
+        }
+    };
+    
+    explicit LookupTablePowerPolicy(bool channelSwitch = false) : m_channelSwitch(channelSwitch)
+    {
+        // 0.5 m x 1 dB x 0.1 Mbps bins over the range the scenario covers
+        Axis distance = {0.0, 40.0, 80};
+        Axis rssi = {-95.0, -25.0, 70};
+        Axis throughput = {0.0, 10.0, 100};
+        SetAxes(distance, rssi, throughput);
+    }
+    
+    void Compile(const IPowerPolicy &source)
+    {
+        LinkObservation obs = LinkObservation();
+        for (uint32_t d = 0; d < m_distance.bins; ++d) {
+            obs.distance = m_distance.Center(d);
+            for (uint32_t r = 0; r < m_rssi.bins; ++r) {
+                obs.rssi = m_rssi.Center(r);
+                for (uint32_t t = 0; t < m_throughput.bins; ++t) {
+                    obs.throughput = m_throughput.Center(t);
+                    m_table[Offset(d, r, t)] = source.Decide(obs);
+                }
+            }
+        }
+    }
+    
+    void Load(const std::string &path)
+    {
+        std::ifstream in(path.c_str());
+        NS_ABORT_MSG_IF(!in, "Cannot open policy table " << path);
+        Axis axes[3];
+        const char *names[3] = {"distance", "rssi", "throughput"};
+        std::string line;
+        uint32_t axis = 0;
+        while (axis < 3 && std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream iss(line);
+            std::string name;
+            iss >> name >> axes[axis].min >> axes[axis].max >> axes[axis].bins;
+            NS_ABORT_MSG_IF(name != names[axis] || !iss || axes[axis].bins == 0 ||
+                            axes[axis].max <= axes[axis].min,
+                            "Policy table " << path << ": bad '" << names[axis] << "' axis line");
+            axis++;
+        }
+        NS_ABORT_MSG_IF(axis < 3, "Policy table " << path << ": missing axis lines");
+        SetAxes(axes[0], axes[1], axes[2]);
+        
+        for (size_t i = 0; i < m_table.size(); ++i) {
+            uint32_t code;
+            NS_ABORT_MSG_IF(!(in >> code) || code >= NUM_POWER_ACTIONS,
+                            "Policy table " << path << ": bad or missing entry " << i);
+            m_table[i] = code;
+        }
+    }
+    
+    void Save(const std::string &path) const
+    {
+        std::ofstream out(path.c_str());
+        out << "# FTM power policy table, action codes:";
+        for (uint32_t a = 0; a < NUM_POWER_ACTIONS; ++a) {
+            out << " " << a << "=" << powerActionNames[a];
+        }
+        out << "\n";
+        out << "distance " << m_distance.min << " " << m_distance.max << " " << m_distance.bins << "\n";
+        out << "rssi " << m_rssi.min << " " << m_rssi.max << " " << m_rssi.bins << "\n";
+        out << "throughput " << m_throughput.min << " " << m_throughput.max << " " << m_throughput.bins << "\n";
+        for (size_t i = 0; i < m_table.size(); ++i) {
+            out << (int)m_table[i] << (((i + 1) % m_throughput.bins) ? " " : "\n");
+        }
+    }
+    
+    PowerAction Decide(const LinkObservation &obs) const
+    {
+        PowerAction action = (PowerAction)m_table[Offset(m_distance.Index(obs.distance),
+                                                          m_rssi.Index(obs.rssi),
+                                                          m_throughput.Index(obs.throughput))];
+        if (m_channelSwitch && action == ACTION_INCREASE_POWER && obs.txPower >= maxTxPower) {
+            return ACTION_INCREASE_POWER_CHANGE_CHANNEL;
+        }
+        return action;
+    }
+    
+private:
+    void SetAxes(const Axis &distance, const Axis &rssi, const Axis &throughput)
+    {
+        m_distance = distance;
+        m_rssi = rssi;
+        m_throughput = throughput;
+        m_table.assign((size_t)distance.bins * rssi.bins * throughput.bins, ACTION_MAINTAIN);
+    }
+    
+    size_t Offset(uint32_t d, uint32_t r, uint32_t t) const
+    {
+        return ((size_t)d * m_rssi.bins + r) * m_throughput.bins + t;
+    }
+    
+    Axis m_distance;
+    Axis m_rssi;
+    Axis m_throughput;
+    std::vector<uint8_t> m_table;
+    bool m_channelSwitch;
+};
+
+// Dense feed-forward network (e.g. exported by ftm_ai_analyzer.py) scored
+// in-process: a tick's observations form one [links x features] matrix that
+// goes through every layer together. Text format, '#' starts a comment:
+//   ftm-mlp 1
+//   features <name>...            (subset of distance rssi throughput pdr delay txPower)
+//   normalize <mean> <std>...     (one pair per feature)
+//   layer <in> <out> relu|linear  (then out*in weights row-major, then out biases)
+// The last layer has one output per PowerAction; the largest wins.
+class ModelPowerPolicy : public IPowerPolicy
+{
+public:
+    explicit ModelPowerPolicy(const std::string &path)
+    {
+        std::ifstream file(path.c_str());
+        NS_ABORT_MSG_IF(!file, "Cannot open policy model " << path);
+        std::stringstream in;
+        std::string line;
+        while (std::getline(file, line)) {
+            in << line.substr(0, line.find('#')) << "\n";
+        }
+        
+        std::string token;
+        uint32_t version = 0;
+        in >> token >> version;
+        NS_ABORT_MSG_IF(token != "ftm-mlp" || version != 1, "Policy model " << path << ": not an ftm-mlp v1 file");
+        
+        in >> token;
+        NS_ABORT_MSG_IF(token != "features", "Policy model " << path << ": expected 'features'");
+        while (in >> token && token != "normalize") {
+            uint32_t f = 0;
+            while (f < NUM_FEATURES && token != featureNames[f]) {
+                f++;
+            }
+            NS_ABORT_MSG_IF(f == NUM_FEATURES, "Policy model " << path << ": unknown feature '" << token << "'");
+            m_features.push_back(f);
+        }
+        NS_ABORT_MSG_IF(m_features.empty() || token != "normalize",
+                        "Policy model " << path << ": expected features then 'normalize'");
+        m_mean.resize(m_features.size());
+        m_scale.resize(m_features.size());
+        for (size_t f = 0; f < m_features.size(); ++f) {
+            float stddev = 0;
+            in >> m_mean[f] >> stddev;
+            m_scale[f] = (stddev > 0) ? 1.0f / stddev : 1.0f;
+        }
+        
+        uint32_t width = m_features.size();
+        while (in >> token) {
+            NS_ABORT_MSG_IF(token != "layer", "Policy model " << path << ": expected 'layer', got '" << token << "'");
+            Layer layer;
+            std::string activation;
+            in >> layer.in >> layer.out >> activation;
+            NS_ABORT_MSG_IF(!in || layer.in != width || layer.out == 0,
+                            "Policy model " << path << ": layer " << m_layers.size() << " does not fit");
+            layer.relu = (activation == "relu");
+            layer.weights.resize((size_t)layer.in * layer.out);
+            layer.bias.resize(layer.out);
+            for (size_t w = 0; w < layer.weights.size(); ++w) {
+                in >> layer.weights[w];
+            }
+            for (uint32_t b = 0; b < layer.out; ++b) {
+                in >> layer.bias[b];
+            }
+            NS_ABORT_MSG_IF(!in, "Policy model " << path << ": truncated layer " << m_layers.size());
+            width = layer.out;
+            m_layers.push_back(layer);
+        }
+        NS_ABORT_MSG_IF(m_layers.empty() || width != NUM_POWER_ACTIONS,
+                        "Policy model " << path << ": output layer must have " << NUM_POWER_ACTIONS << " units");
+    }
+    
+    PowerAction Decide(const LinkObservation &obs) const
+    {
+        std::vector<PowerAction> actions;
+        DecideBatch(std::vector<LinkObservation>(1, obs), actions);
+        return actions[0];
+    }
+    
+    void DecideBatch(const std::vector<LinkObservation> &obs, std::vector<PowerAction> &actions) const
+    {
+        size_t rows = obs.size();
+        uint32_t width = m_features.size();
+        m_input.resize(rows * width);
+        for (size_t i = 0; i < rows; ++i) {
+            for (uint32_t f = 0; f < width; ++f) {
+                m_input[i * width + f] = (FeatureValue(obs[i], m_features[f]) - m_mean[f]) * m_scale[f];
+            }
+        }
+        
+        for (size_t l = 0; l < m_layers.size(); ++l) {
+            const Layer &layer = m_layers[l];
+            m_output.resize(rows * layer.out);
+            for (size_t i = 0; i < rows; ++i) {
+                const float *x = &m_input[i * layer.in];
+                float *y = &m_output[i * layer.out];
+                for (uint32_t o = 0; o < layer.out; ++o) {
+                    const float *w = &layer.weights[(size_t)o * layer.in];
+                    float sum = layer.bias[o];
+                    for (uint32_t k = 0; k < layer.in; ++k) {
+                        sum += w[k] * x[k];
+                    }
+                    y[o] = (layer.relu && sum < 0) ? 0.0f : sum;
+                }
+            }
+            m_input.swap(m_output);
+        }
+        
+        actions.resize(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            actions[i] = ArgMaxAction(&m_input[i * NUM_POWER_ACTIONS]);
+        }
+    }
+    
+private:
+    struct Layer
+    {
+        uint32_t in;
+        uint32_t out;
+        bool relu;
+        std::vector<float> weights; // out x in
+        std::vector<float> bias;
+    };
+    
+    std::vector<uint32_t> m_features;
+    std::vector<float> m_mean;
+    std::vector<float> m_scale;
+    std::vector<Layer> m_layers;
+    mutable std::vector<float> m_input;  // scratch, reused across ticks
+    mutable std::vector<float> m_output;
+};
+
+#ifdef FTM_WITH_ONNXRUNTIME
+// ONNX Runtime backend (build with -DFTM_WITH_ONNXRUNTIME and link
+// onnxruntime). The model takes a float [links x NUM_FEATURES] input in
+// ObservationFeature order and returns [links x NUM_POWER_ACTIONS] scores.
+class OnnxPowerPolicy : public IPowerPolicy
+{
+public:
+    OnnxPowerPolicy(const std::string &path, const std::string &inputName, const std::string &outputName)
+        : m_env(ORT_LOGGING_LEVEL_WARNING, "ftm-adaptive-wifi"),
+          m_session(nullptr),
+          m_memory(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)),
+          m_inputName(inputName),
+          m_outputName(outputName)
+    {
+        Ort::SessionOptions options;
+        options.SetIntraOpNumThreads(1); // the simulator is single threaded anyway
+        m_session = Ort::Session(m_env, path.c_str(), options);
+    }
+    
+    PowerAction Decide(const LinkObservation &obs) const
+    {
+        std::vector<PowerAction> actions;
+        DecideBatch(std::vector<LinkObservation>(1, obs), actions);
+        return actions[0];
+    }
+    
+    void DecideBatch(const std::vector<LinkObservation> &obs, std::vector<PowerAction> &actions) const
+    {
+        actions.resize(obs.size());
+        if (obs.empty()) {
+            return;
+        }
+        m_input.resize(obs.size() * NUM_FEATURES);
+        for (size_t i = 0; i < obs.size(); ++i) {
+            for (uint32_t f = 0; f < NUM_FEATURES; ++f) {
+                m_input[i * NUM_FEATURES + f] = FeatureValue(obs[i], f);
+            }
+        }
+        int64_t shape[2] = {(int64_t)obs.size(), NUM_FEATURES};
+        Ort::Value input = Ort::Value::CreateTensor<float>(m_memory, m_input.data(), m_input.size(), shape, 2);
+        const char *inputNames[1] = {m_inputName.c_str()};
+        const char *outputNames[1] = {m_outputName.c_str()};
+        std::vector<Ort::Value> output = m_session.Run(Ort::RunOptions{nullptr}, inputNames, &input, 1,
+                                                       outputNames, 1);
+        const float *scores = output[0].GetTensorData<float>();
+        for (size_t i = 0; i < obs.size(); ++i) {
+            actions[i] = ArgMaxAction(scores + i * NUM_POWER_ACTIONS);
+        }
+    }
+    
+private:
+    Ort::Env m_env;
+    mutable Ort::Session m_session;
+    Ort::MemoryInfo m_memory;
+    std::string m_inputName;
+    std::string m_outputName;
+    mutable std::vector<float> m_input;
+};
+#endif
+
+// Closed loop with an external agent (ftm_bridge.py) through a POSIX shared
+// memory segment, ns3-gym style without the sockets. The simulator writes
+// the whole tick straight into the mapping, publishes it by bumping
+// requestSeq and waits for responseSeq to match, at most bridgeTimeout ms;
+// a late or missing answer falls back to the threshold rules for that tick.
+// Layout (little endian): BridgeHeader, bridgeRules doubles (the fallback
+// threshold rules, so an agent can mirror them), capacity x bridgeFields
+// doubles, capacity int32 actions (PowerAction codes).
+std::string bridgeName = "/ftm-bridge"; // shm_open name (/dev/shm/ftm-bridge)
+double bridgeTimeout = 100.0;           // ms the simulator waits per tick
+double bridgeConnectTimeout = 30.0;     // s to wait for the agent before the first tick
+uint64_t bridgeTicks = 0;
+uint64_t bridgeTimeouts = 0;
+
+const uint32_t bridgeMagic = 0x424d5446; // "FTMB"
+const uint32_t bridgeVersion = 2;
+// Per link: ap sta distance throughput pdr delay rssi txPower networkThroughput
+const uint32_t bridgeFields = 9;
+// ThresholdPowerPolicy::PublishRules
+const uint32_t bridgeRules = 9;
+
+struct BridgeHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;    // links the segment holds
+    uint32_t fields;      // doubles per link
+    uint64_t requestSeq;  // simulator: tick published
+    uint64_t responseSeq; // agent: actions of tick requestSeq written
+    uint32_t count;       // links in this tick
+    uint32_t finished;    // simulator: 1 once the run is over
+    double simTime;       // s
+    uint32_t agentPid;    // agent: nonzero once attached
+    uint32_t rules;       // doubles in the rules block
+    uint8_t reserved[8];
+};
+static_assert(sizeof(BridgeHeader) == 64, "BridgeHeader is shared with ftm_bridge.py");
+
+class BridgePowerPolicy : public IPowerPolicy
+{
+public:
+    BridgePowerPolicy(const std::string &name, uint32_t capacity, const ThresholdPowerPolicy &fallback)
+        : m_name(name), m_fallback(fallback), m_seq(0), m_connected(false)
+    {
+        m_size = sizeof(BridgeHeader) + bridgeRules * sizeof(double) +
+                 (size_t)capacity * (bridgeFields * sizeof(double) + sizeof(int32_t));
+        m_fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        NS_ABORT_MSG_IF(m_fd < 0, "Cannot create shared memory " << name << ": " << std::strerror(errno));
+        NS_ABORT_MSG_IF(ftruncate(m_fd, 0) != 0 || ftruncate(m_fd, m_size) != 0,
+                        "Cannot size shared memory " << name << ": " << std::strerror(errno));
+        void *base = mmap(0, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        NS_ABORT_MSG_IF(base == MAP_FAILED, "Cannot map shared memory " << name << ": " << std::strerror(errno));
+        m_header = static_cast<BridgeHeader *>(base);
+        double *rules = reinterpret_cast<double *>(m_header + 1);
+        m_obs = rules + bridgeRules;
+        m_actions = reinterpret_cast<int32_t *>(m_obs + (size_t)capacity * bridgeFields);
+        
+        // ftruncate zero-filled the segment; the magic goes last
+        m_header->version = bridgeVersion;
+        m_header->capacity = capacity;
+        m_header->fields = bridgeFields;
+        m_header->rules = bridgeRules;
+        fallback.PublishRules(rules);
+        __atomic_store_n(&m_header->magic, bridgeMagic, __ATOMIC_RELEASE);
+    }
+    
+    ~BridgePowerPolicy()
+    {
+        __atomic_store_n(&m_header->finished, 1u, __ATOMIC_RELEASE);
+        munmap(m_header, m_size);
+        close(m_fd);
+        shm_unlink(m_name.c_str());
+    }
+    
+    PowerAction Decide(const LinkObservation &obs) const
+    {
+        std::vector<LinkObservation> one(1, obs);
+        std::vector<PowerAction> actions;
+        DecideBatch(one, actions);
+        return actions[0];
+    }
+    
+    // One message per tick, whatever the AP count
+    void DecideBatch(const std::vector<LinkObservation> &obs, std::vector<PowerAction> &actions) const
+    {
+        NS_ABORT_MSG_IF(obs.size() > m_header->capacity, "Bridge tick larger than the shared segment");
+        WaitForAgent();
+        for (size_t i = 0; i < obs.size(); ++i) {
+            double *row = m_obs + i * bridgeFields;
+            row[0] = obs[i].ap;
+            row[1] = obs[i].sta;
+            row[2] = obs[i].distance;
+            row[3] = obs[i].throughput;
+            row[4] = obs[i].pdr;
+            row[5] = obs[i].delay;
+            row[6] = obs[i].rssi;
+            row[7] = obs[i].txPower;
+            row[8] = obs[i].networkThroughput;
+        }
+        m_header->count = obs.size();
+        m_header->simTime = Simulator::Now().GetSeconds();
+        __atomic_store_n(&m_header->requestSeq, ++m_seq, __ATOMIC_RELEASE);
+        bridgeTicks++;
+        
+        if (!Await(&m_header->responseSeq, m_seq, bridgeTimeout / 1000.0)) {
+            bridgeTimeouts++;
+            m_fallback.DecideBatch(obs, actions);
+            return;
+        }
+        actions.resize(obs.size());
+        for (size_t i = 0; i < obs.size(); ++i) {
+            int32_t code = m_actions[i];
+            actions[i] = (code >= 0 && code < NUM_POWER_ACTIONS) ? (PowerAction)code : ACTION_MAINTAIN;
+        }
+    }
+    
+private:
+    void WaitForAgent() const
+    {
+        if (m_connected) {
+            return;
+        }
+        std::cout << "Bridge: waiting for an agent on " << m_name << " (python3 ftm_bridge.py)" << std::endl;
+        ProfileClock::time_point deadline = ProfileClock::now() +
+            std::chrono::duration_cast<ProfileClock::duration>(std::chrono::duration<double>(bridgeConnectTimeout));
+        while (__atomic_load_n(&m_header->agentPid, __ATOMIC_ACQUIRE) == 0) {
+            NS_ABORT_MSG_IF(ProfileClock::now() > deadline,
+                            "No agent attached to " << m_name << " within " << bridgeConnectTimeout << " s");
+            usleep(1000);
+        }
+        m_connected = true;
+    }
+    
+    // Spin briefly, then yield, then sleep in short steps until the deadline
+    static bool Await(const uint64_t *seq, uint64_t expected, double seconds)
+    {
+        ProfileClock::time_point deadline = ProfileClock::now() +
+            std::chrono::duration_cast<ProfileClock::duration>(std::chrono::duration<double>(seconds));
+        for (uint32_t spin = 0; ; ++spin) {
+            if (__atomic_load_n(seq, __ATOMIC_ACQUIRE) == expected) {
+                return true;
+            }
+            if (ProfileClock::now() > deadline) {
+                return false;
+            }
+            if (spin > 1000) {
+                usleep(50);
+            } else if (spin > 100) {
+                sched_yield();
+            }
+        }
+    }
+    
+    std::string m_name;
+    ThresholdPowerPolicy m_fallback;
+    int m_fd;
+    size_t m_size;
+    BridgeHeader *m_header;
+    double *m_obs;
+    int32_t *m_actions;
+    mutable uint64_t m_seq;
+    mutable bool m_connected;
+};
+
+std::string policyName = "threshold"; // threshold | table | model | bridge
+std::string policyTable = "";         // table file to load (empty = compile from thresholds)
+std::string policyTableOut = "";      // write the compiled table here
+std::string policyModel = "";         // model file for --policy=model (.onnx needs FTM_WITH_ONNXRUNTIME)
+std::string policyModelInput = "input";   // ONNX input tensor name
+std::string policyModelOutput = "scores"; // ONNX output tensor name
+std::unique_ptr<IPowerPolicy> powerPolicy;
+
+// Channel changes only mean something when BSSs share the medium
+bool ChannelSwitchingEnabled()
+{
+    return channelMode == "shared" && channelPool.size() > 1;
+}
+
+void SetupPowerPolicy()
+{
+    ThresholdPowerPolicy thresholdPolicy(thresholds, ChannelSwitchingEnabled());
+    if (policyName == "threshold") {
+        powerPolicy.reset(new ThresholdPowerPolicy(thresholdPolicy));
+        return;
+    }
+    
+    if (policyName == "bridge") {
+        std::string name = bridgeName;
+        if (Distributed()) {
+            std::ostringstream rankName;
+            rankName << bridgeName << "-rank-" << systemId;
+            name = rankName.str();
+        }
+        powerPolicy.reset(new BridgePowerPolicy(name, numAps * stasPerAp, thresholdPolicy));
+        return;
+    }
+    
+    if (policyName == "model") {
+        NS_ABORT_MSG_IF(policyModel.empty(), "--policy=model needs --policyModel");
+        bool onnx = policyModel.size() > 5 && policyModel.compare(policyModel.size() - 5, 5, ".onnx") == 0;
+        if (onnx) {
+#ifdef FTM_WITH_ONNXRUNTIME
+            powerPolicy.reset(new OnnxPowerPolicy(policyModel, policyModelInput, policyModelOutput));
+#else
+            NS_ABORT_MSG("ONNX model " << policyModel << " needs a build with -DFTM_WITH_ONNXRUNTIME");
+#endif
+        } else {
+            powerPolicy.reset(new ModelPowerPolicy(policyModel));
+        }
+        return;
+    }
+    
+    LookupTablePowerPolicy *table = new LookupTablePowerPolicy(ChannelSwitchingEnabled());
+    if (policyTable.empty()) {
+        table->Compile(thresholdPolicy);
+    } else {
+        table->Load(policyTable);
+    }
+    if (!policyTableOut.empty()) {
+        table->Save(policyTableOut);
+    }
+    powerPolicy.reset(table);
+}
+
+// Push a new TX power straight into the AP's PHY; with TxPowerStart ==
+// TxPowerEnd the PHY has a single power level that every frame uses
+void SetApTxPower(uint32_t ap, double txPower)
+{
+    bss[ap].txPower = txPower;
+    bss[ap].apPhy->SetTxPowerStart(txPower);
+    bss[ap].apPhy->SetTxPowerEnd(txPower);
+}
+
+// Move an AP and its STAs to the other pool channel with the fewest APs
+// (an idealized channel switch announcement: the whole BSS moves at once)
+void SwitchApChannel(uint32_t ap)
+{
+    BssState &b = bss[ap];
+    uint8_t best = b.channel;
+    uint32_t bestLoad = std::numeric_limits<uint32_t>::max();
+    for (size_t c = 0; c < channelPool.size(); ++c) {
+        uint8_t candidate = channelPool[c];
+        if (candidate == b.channel) {
+            continue;
+        }
+        uint32_t load = 0;
+        for (uint32_t k = 0; k < numAps; ++k) {
+            load += (k != ap && bss[k].channel == candidate);
+        }
+        if (load < bestLoad) {
+            best = candidate;
+            bestLoad = load;
+        }
+    }
+    
+    b.apPhy->SetChannelNumber(best);
+    for (uint32_t k = 0; k < b.staDevices.GetN(); ++k) {
+        DynamicCast<WifiNetDevice>(b.staDevices.Get(k))->GetPhy()->SetChannelNumber(best);
+    }
+    NS_LOG_INFO("AI Decision: Moving AP" << ap + 1 << " from channel " << (uint32_t)b.channel
+                << " to " << (uint32_t)best);
+    b.channel = best;
+    b.lastChannelSwitch = Simulator::Now();
+    b.channelSwitches++;
+}
+
+// Actuation: "direct" applies every decision at once in fixed 2 dB steps;
+// "hysteresis" ignores decisions while the link is within hysteresisBand of
+// targetThroughput, leaves actuationDwell between two changes of one AP and
+// moves at most powerStep dB, and no faster than slewLimit dB/s. A change
+// comes at least actuationDwell after the last one, so the slew limit only
+// binds when slewLimit * actuationDwell < powerStep (by default 0.75 dB per
+// change). Every change sends Minstrel back to rate training, so both modes
+// count them.
+std::string actuation = "direct";
+double hysteresisBand = 0.5; // Mbps either side of targetThroughput
+double actuationDwell = 3.0; // s between two changes of one AP
+double powerStep = 1.0;      // dB per change (hysteresis)
+double slewLimit = 0.25;     // dB/s (hysteresis)
+uint64_t totalActuations = 0; // all runs of the process
+uint64_t controlTick = 0;     // control ticks of the current run
+
+// On a shared channel a louder AP costs its neighbours throughput: an AP
+// whose step-up request was followed, one tick later, by a network
+// throughput more than 1% lower holds for that tick. Remembers the request
+// otherwise. Applies to the per-AP action, whichever policy produced it.
+bool HoldAfterBoost(uint32_t ap, double networkThroughput)
+{
+    BssState &b = bss[ap];
+    if (b.boostTick > 0 && b.boostTick + 1 == controlTick && networkThroughput < b.boostNetwork * 0.99) {
+        return true;
+    }
+    b.boostTick = controlTick;
+    b.boostNetwork = networkThroughput;
+    return false;
+}
+
+void CountActuation(uint32_t ap)
+{
+    bss[ap].lastActuation = Simulator::Now();
+    bss[ap].actuations++;
+    totalActuations++;
+}
+
+void ApplyAIDecision(PowerAction decision, uint32_t ap)
+{
+    double txPower = bss[ap].txPower;
+    uint8_t channel = bss[ap].channel;
+    if (decision == ACTION_INCREASE_POWER && txPower < maxTxPower) {
+        SetApTxPower(ap, txPower + 2.0);
+        NS_LOG_INFO("AI Decision: Increasing AP" << ap + 1 << " TX power to " << bss[ap].txPower << " dBm");
+    } else if (decision == ACTION_DECREASE_POWER && txPower > minTxPower) {
+        SetApTxPower(ap, txPower - 2.0);
+        NS_LOG_INFO("AI Decision: Decreasing AP" << ap + 1 << " TX power to " << bss[ap].txPower << " dBm");
+    } else if (decision == ACTION_INCREASE_POWER_CHANGE_CHANNEL) {
+        if (txPower < maxTxPower) {
+            SetApTxPower(ap, txPower + 3.0);
+            NS_LOG_INFO("AI Decision: Aggressive increase AP" << ap + 1 << " TX power to " << bss[ap].txPower << " dBm");
+        }
+        if (ChannelSwitchingEnabled() &&
+            Simulator::Now() - bss[ap].lastChannelSwitch >= Seconds(channelDwell)) {
+            SwitchApChannel(ap);
+        }
+    }
+    if (bss[ap].txPower != txPower || bss[ap].channel != channel) {
+        CountActuation(ap);
+    }
+}
+
+// Act on a decision for an AP whose worst link delivers worstThroughput
+void ActuateAp(PowerAction decision, uint32_t ap, double worstThroughput)
+{
+    if (actuation == "direct") {
+        ApplyAIDecision(decision, ap);
+        return;
+    }
+    BssState &b = bss[ap];
+    bool up = (decision == ACTION_INCREASE_POWER || decision == ACTION_INCREASE_POWER_CHANGE_CHANNEL) &&
+              worstThroughput < thresholds.targetThroughput - hysteresisBand;
+    bool down = decision == ACTION_DECREASE_POWER &&
+                worstThroughput > thresholds.targetThroughput + hysteresisBand;
+    double elapsed = (Simulator::Now() - b.lastActuation).GetSeconds();
+    if ((!up && !down) || elapsed < actuationDwell) {
+        return;
+    }
+    
+    if (up && decision == ACTION_INCREASE_POWER_CHANGE_CHANNEL && b.txPower >= maxTxPower) {
+        if (ChannelSwitchingEnabled() && Simulator::Now() - b.lastChannelSwitch >= Seconds(channelDwell)) {
+            SwitchApChannel(ap);
+            CountActuation(ap);
+        }
+        return;
+    }
+    double step = std::min(powerStep, slewLimit * elapsed);
+    double txPower = up ? std::min(b.txPower + step, maxTxPower) : std::max(b.txPower - step, minTxPower);
+    if (txPower != b.txPower) {
+        SetApTxPower(ap, txPower);
+        CountActuation(ap);
+        NS_LOG_INFO("Actuation: AP" << ap + 1 << " TX power " << txPower << " dBm");
+    }
+}
+
+// Controller changes of each AP in this run, next to its metrics
+void WriteActuationReport()
+{
+    std::ofstream out(OutputPath("ftm_actuations.csv").c_str());
+    out << "AP,Actuations,ChannelSwitches,FinalTxPower(dBm)\n";
+    for (uint32_t i = 0; i < numAps; ++i) {
+        out << "AP" << i + 1 << "," << bss[i].actuations << "," << bss[i].channelSwitches << ","
+            << bss[i].txPower << "\n";
+    }
+}
+
+// Interval to the next sample: the fast interval while any mobile STA is
+// moving (WaypointMobilityModel velocity), the base interval otherwise
+double NextSampleInterval()
+{
+    if (!adaptiveSampling) {
+        return sampleInterval;
+    }
+    for (uint32_t k = 0; k < mobileStations.size(); ++k) {
+        Vector v = stations[mobileStations[k]].node->GetObject<MobilityModel>()->GetVelocity();
+        if (v.x * v.x + v.y * v.y + v.z * v.z > movingSpeed * movingSpeed) {
+            return fastSampleInterval;
+        }
+    }
+    return sampleInterval;
+}
+
+// ============== Link Quality ==============
+// Downlink signal/noise as the STA PHY actually receives it (beacons, ACKs
+// and any frame of its own AP), from the MonitorSnifferRx trace. The
+// per-packet path is a fixed-size ring write plus an EWMA update: no
+// allocation, O(1).
+std::string rssiSource = "phy"; // phy (measured) | friis (analytic, as before) | logdistance (the channel's model)
+double rssiEwmaAlpha = 0.1;     // weight of a new sample in the EWMA
+const uint32_t rssiRingSize = 32; // recent samples kept per STA
+
+struct LinkQuality
+{
+    Mac48Address own;       // STA address
+    Mac48Address bssid;     // its AP
+    float signal[rssiRingSize]; // dBm
+    uint32_t head;          // next slot to write
+    uint32_t count;         // valid samples (<= rssiRingSize)
+    double ewmaSignal;      // dBm
+    double ewmaSnr;         // dB
+};
+std::vector<LinkQuality> linkQuality; // indexed by STA id
+
+void OnStaSnifferRx(uint32_t sta, Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                    WifiTxVector txVector, MpduInfo aMpdu, SignalNoiseDbm signalNoise,
+                    uint16_t staId)
+{
+    LinkQuality &link = linkQuality[sta];
+    WifiMacHeader header;
+    packet->PeekHeader(header);
+    // Control frames (ACK, CTS) carry no transmitter address; the ones
+    // addressed to this STA come from its AP
+    bool fromAp = header.IsCtl() ? (header.GetAddr1() == link.own) : (header.GetAddr2() == link.bssid);
+    if (!fromAp) {
+        return; // overheard uplink of another STA in the BSS
+    }
+    
+    double snr = signalNoise.signal - signalNoise.noise;
+    link.signal[link.head] = signalNoise.signal;
+    link.head = (link.head + 1) % rssiRingSize;
+    if (link.count == 0) {
+        link.ewmaSignal = signalNoise.signal;
+        link.ewmaSnr = snr;
+    } else {
+        link.ewmaSignal += rssiEwmaAlpha * (signalNoise.signal - link.ewmaSignal);
+        link.ewmaSnr += rssiEwmaAlpha * (snr - link.ewmaSnr);
+    }
+    if (link.count < rssiRingSize) {
+        link.count++;
+    }
+}
+
+// Weakest signal among the STA's last rssiRingSize frames (dBm)
+double RecentMinRssi(uint32_t sta)
+{
+    const LinkQuality &link = linkQuality[sta];
+    double weakest = link.signal[0];
+    for (uint32_t k = 1; k < link.count; ++k) {
+        weakest = std::min(weakest, (double)link.signal[k]);
+    }
+    return weakest;
+}
+
+void SetupLinkQuality()
+{
+    if (rssiSource != "phy") {
+        return;
+    }
+    linkQuality.assign(stations.size(), LinkQuality());
+    for (uint32_t i = 0; i < numAps; ++i) {
+        Mac48Address bssid = Mac48Address::ConvertFrom(bss[i].apDevice.Get(0)->GetAddress());
+        for (uint32_t k = 0; k < stasPerAp; ++k) {
+            uint32_t sta = bss[i].firstSta + k;
+            Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice>(bss[i].staDevices.Get(k));
+            linkQuality[sta].own = Mac48Address::ConvertFrom(device->GetAddress());
+            linkQuality[sta].bssid = bssid;
+            device->GetPhy()->TraceConnectWithoutContext("MonitorSnifferRx",
+                                                         MakeBoundCallback(&OnStaSnifferRx, sta));
+        }
+    }
+}
+
+// ============== FTM Ranging ==============
+// 802.11mc-style FTM sessions give the controller a measured range instead
+// of the mobility ground truth. Every burst the AP (responder) sends
+// ftmFramesPerBurst FTM frames to the STA over the real channel on AC_VO
+// (so they contend with data and are never aggregated); each frame that
+// arrives yields one range sample with Gaussian error, and the burst's
+// mean becomes the STA's range. FTM airtime is measured on the AP PHY.
+bool ftm = false;                   // range with FTM bursts (false = ground-truth distance)
+double ftmBurstsPerSecond = 4.0;    // bursts per AP-STA session per second
+uint32_t ftmFramesPerBurst = 3;     // FTM frames (range samples) per burst
+double ftmFrameSpacing = 0.001;     // s between the FTM frames of a burst (min delta FTM)
+uint32_t ftmFrameBytes = 40;        // FTM action frame body
+double ftmRangeStd = 1.0;           // m, standard deviation of one range sample
+const uint16_t ftmProtocol = 0x88B5; // IEEE local experimental EtherType
+
+struct FtmSession
+{
+    double range;       // m, mean of the last burst (< 0 until the first burst completes)
+    double burstSum;    // current burst accumulator
+    uint32_t burstSamples;
+    Time airtime;       // FTM airtime since airtimeSince
+    Time airtimeSince;
+    uint64_t framesTx;  // PHY transmissions, retries included
+    uint64_t framesRx;
+    Time totalAirtime;
+    double errorSq;     // sum of squared range errors of completed bursts
+    uint32_t bursts;
+};
+std::vector<FtmSession> ftmSessions; // indexed by STA id
+Ptr<NormalRandomVariable> ftmError;
+
+// Marks FTM frames so the AP sniffer can tell them from data
+class FtmFrameTag : public Tag
+{
+public:
+    FtmFrameTag() : m_sta(0) {}
+    explicit FtmFrameTag(uint32_t sta) : m_sta(sta) {}
+    
+    static TypeId GetTypeId()
+    {
+        static TypeId tid = TypeId("FtmFrameTag").SetParent<Tag>().AddConstructor<FtmFrameTag>();
+        return tid;
+    }
+    TypeId GetInstanceTypeId() const { return GetTypeId(); }
+    uint32_t GetSerializedSize() const { return 4; }
+    void Serialize(TagBuffer buffer) const { buffer.WriteU32(m_sta); }
+    void Deserialize(TagBuffer buffer) { m_sta = buffer.ReadU32(); }
+    void Print(std::ostream &os) const { os << "sta=" << m_sta; }
+    uint32_t GetSta() const { return m_sta; }
+    
+private:
+    uint32_t m_sta;
+};
+
+void SendFtmFrame(uint32_t sta)
+{
+    uint32_t ap = stations[sta].ap;
+    Ptr<Packet> frame = Create<Packet>(ftmFrameBytes);
+    frame->AddPacketTag(FtmFrameTag(sta));
+    SocketPriorityTag priority;
+    priority.SetPriority(6); // AC_VO
+    frame->AddPacketTag(priority);
+    Address staAddress = bss[ap].staDevices.Get(sta - bss[ap].firstSta)->GetAddress();
+    bss[ap].apDevice.Get(0)->Send(frame, staAddress, ftmProtocol);
+}
+
+void FinishFtmBurst(uint32_t sta)
+{
+    FtmSession &session = ftmSessions[sta];
+    if (session.burstSamples > 0) {
+        // A burst with every frame lost keeps the previous (stale) range
+        session.range = session.burstSum / session.burstSamples;
+        double truth = CalculateDistance(bss[stations[sta].ap].apNode, stations[sta].node);
+        session.errorSq += (session.range - truth) * (session.range - truth);
+        session.bursts++;
+    }
+}
+
+void StartFtmBurst(uint32_t sta)
+{
+    if (Simulator::Now().GetSeconds() >= trafficEnd) {
+        return;
+    }
+    FtmSession &session = ftmSessions[sta];
+    session.burstSum = 0;
+    session.burstSamples = 0;
+    for (uint32_t k = 0; k < ftmFramesPerBurst; ++k) {
+        Simulator::Schedule(Seconds(k * ftmFrameSpacing), &SendFtmFrame, sta);
+    }
+    // Late frames of this burst still count until the window closes
+    Simulator::Schedule(Seconds((ftmFramesPerBurst + 1) * ftmFrameSpacing), &FinishFtmBurst, sta);
+    Simulator::Schedule(Seconds(1.0 / ftmBurstsPerSecond), &StartFtmBurst, sta);
+}
+
+void OnFtmFrameRx(uint32_t sta, Ptr<NetDevice> device, Ptr<const Packet> packet, uint16_t protocol,
+                  const Address &from, const Address &to, NetDevice::PacketType packetType)
+{
+    FtmSession &session = ftmSessions[sta];
+    double truth = CalculateDistance(bss[stations[sta].ap].apNode, stations[sta].node);
+    session.burstSum += std::max(0.0, truth + ftmError->GetValue(0.0, ftmRangeStd * ftmRangeStd));
+    session.burstSamples++;
+    session.framesRx++;
+}
+
+void OnFtmAirtime(uint32_t ap, Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                  WifiTxVector txVector, MpduInfo aMpdu, uint16_t staId)
+{
+    FtmFrameTag tag;
+    if (!packet->PeekPacketTag(tag)) {
+        return;
+    }
+    FtmSession &session = ftmSessions[tag.GetSta()];
+    Time duration = WifiPhy::CalculateTxDuration(packet->GetSize(), txVector, bss[ap].apPhy->GetPhyBand());
+    session.airtime += duration;
+    session.totalAirtime += duration;
+    session.framesTx++;
+}
+
+// Percentage of the time since the last call that STA's FTM frames kept
+// its AP's channel busy
+double TakeFtmAirtime(uint32_t sta)
+{
+    FtmSession &session = ftmSessions[sta];
+    Time window = Simulator::Now() - session.airtimeSince;
+    double percent = window.IsStrictlyPositive() ?
+        session.airtime.GetSeconds() / window.GetSeconds() * 100.0 : 0.0;
+    session.airtime = Seconds(0);
+    session.airtimeSince = Simulator::Now();
+    return percent;
+}
+
+// Range the controller sees: the FTM measurement, or ground truth when FTM
+// is off (and until a session's first burst completes)
+double MeasuredRange(uint32_t sta, double trueDistance)
+{
+    if (!ftm || ftmSessions[sta].range < 0) {
+        return trueDistance;
+    }
+    return ftmSessions[sta].range;
+}
+
+void SetupFtm(double start)
+{
+    if (!ftm) {
+        return;
+    }
+    ftmError = CreateObject<NormalRandomVariable>();
+    FtmSession empty = FtmSession();
+    empty.range = -1.0;
+    empty.airtimeSince = Seconds(start);
+    ftmSessions.assign(stations.size(), empty);
+    
+    for (uint32_t i = 0; i < numAps; ++i) {
+        if (!IsLocal(bss[i].apNode)) {
+            continue;
+        }
+        bss[i].apPhy->TraceConnectWithoutContext("MonitorSnifferTx", MakeBoundCallback(&OnFtmAirtime, i));
+        for (uint32_t k = 0; k < stasPerAp; ++k) {
+            uint32_t sta = bss[i].firstSta + k;
+            stations[sta].node->RegisterProtocolHandler(MakeBoundCallback(&OnFtmFrameRx, sta), ftmProtocol,
+                                                        bss[i].staDevices.Get(k));
+            // Stagger every session of every AP across the burst period, so
+            // neither STAs nor APs burst in lockstep
+            double offset = (double)(i * stasPerAp + k) / (numAps * stasPerAp) / ftmBurstsPerSecond;
+            Simulator::Schedule(Seconds(start + offset), &StartFtmBurst, sta);
+        }
+    }
+}
+
+// ============== Power Coordinator ==============
+// --coordinator=joint puts the links of every BSS (not only the mobile ones)
+// into the tick's batch and, after the policy has scored them in one call,
+// solves one power setting per AP:
+//  - an AP serves its worst link: one link below target is enough to step
+//    up, power only drops when every link has margin to spare
+//  - on a shared channel only the co-channel AP with the largest shortfall
+//    may step up in a tick, so neighbours stop answering each other's
+//    increase with their own
+//  - a co-channel AP that is short of target at full power gets help from
+//    neighbours that meet target and reach one of its STAs above
+//    interferenceThreshold (per-tick path-loss matrix): they step down to
+//    cut its interference
+// One pass over the links and one over the APs per tick.
+std::string coordinator = "off"; // off (mobile BSSs, each AP takes its links' strongest request) | joint
+double interferenceThreshold = -82.0; // dBm, 802.11 preamble detection at 20 MHz
+
+struct ApDemand
+{
+    PowerAction action; // strongest request of the AP's links
+    double shortfall;   // targetThroughput minus the worst link (Mbps)
+    uint32_t links;
+};
+std::vector<ApDemand> apDemands;
+
+// Order of precedence when one AP's links disagree
+int ActionRank(PowerAction action)
+{
+    switch (action) {
+        case ACTION_DECREASE_POWER: return 0;
+        case ACTION_MAINTAIN: return 1;
+        case ACTION_INCREASE_POWER: return 2;
+        default: return 3;
+    }
+}
+
+bool WantsMorePower(PowerAction action)
+{
+    return action == ACTION_INCREASE_POWER || action == ACTION_INCREASE_POWER_CHANGE_CHANNEL;
+}
+
+// Whether 'ap' is heard by a STA of a starved co-channel BSS
+bool DisturbsStarvedBss(uint32_t ap, const std::vector<uint8_t> &starvedAps)
+{
+    const double *loss = &geometry.pathLoss[(size_t)ap * stations.size()];
+    for (uint32_t other = 0; other < numAps; ++other) {
+        if (other == ap || !starvedAps[other] || bss[other].channel != bss[ap].channel) {
+            continue;
+        }
+        uint32_t first = bss[other].firstSta;
+        const double *closest = std::min_element(loss + first, loss + first + bss[other].staDevices.GetN());
+        if (bss[ap].txPower - *closest >= interferenceThreshold) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Per-link actions in, one action per AP out (APs without links hold):
+// the strongest request of its links, so an AP moves once per tick however
+// many STAs it serves
+void ReduceToApDemands(const std::vector<LinkObservation> &observations,
+                       const std::vector<PowerAction> &actions)
+{
+    ApDemand idle;
+    idle.action = ACTION_MAINTAIN;
+    idle.shortfall = -std::numeric_limits<double>::max();
+    idle.links = 0;
+    apDemands.assign(numAps, idle);
+    for (size_t i = 0; i < observations.size(); ++i) {
+        ApDemand &demand = apDemands[observations[i].ap];
+        if (demand.links == 0 || ActionRank(actions[i]) > ActionRank(demand.action)) {
+            demand.action = actions[i];
+        }
+        demand.shortfall = std::max(demand.shortfall, thresholds.targetThroughput - observations[i].throughput);
+        demand.links++;
+    }
+}
+
+// The per-AP demands, then arbitration between co-channel APs
+void CoordinatePower(const std::vector<LinkObservation> &observations,
+                     const std::vector<PowerAction> &actions)
+{
+    ReduceToApDemands(observations, actions);
+    if (channelMode != "shared") {
+        return; // separate channel objects: the BSSs do not interfere
+    }
+    
+    // Per channel: the AP allowed to step up, and whether an AP is stuck at full power
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    uint32_t riser[256];
+    bool starved[256];
+    std::fill(riser, riser + 256, none);
+    std::fill(starved, starved + 256, false);
+    std::vector<uint8_t> starvedAps(numAps, 0);
+    for (uint32_t ap = 0; ap < numAps; ++ap) {
+        const ApDemand &demand = apDemands[ap];
+        uint8_t ch = bss[ap].channel;
+        if (demand.links == 0 || demand.shortfall <= 0) {
+            continue;
+        }
+        bool atMax = bss[ap].txPower >= maxTxPower;
+        if (atMax) {
+            starved[ch] = true;
+            starvedAps[ap] = 1;
+        }
+        // At full power only a channel change still does something
+        bool canRise = demand.action == ACTION_INCREASE_POWER_CHANGE_CHANNEL ||
+                       (demand.action == ACTION_INCREASE_POWER && !atMax);
+        if (canRise && (riser[ch] == none || demand.shortfall > apDemands[riser[ch]].shortfall)) {
+            riser[ch] = ap;
+        }
+    }
+    for (uint32_t ap = 0; ap < numAps; ++ap) {
+        ApDemand &demand = apDemands[ap];
+        uint8_t ch = bss[ap].channel;
+        if (WantsMorePower(demand.action) && riser[ch] != ap) {
+            demand.action = ACTION_MAINTAIN;
+        } else if (starved[ch] && demand.links > 0 && demand.shortfall < 0 &&
+                   demand.action == ACTION_MAINTAIN && DisturbsStarvedBss(ap, starvedAps)) {
+            demand.action = ACTION_DECREASE_POWER;
+        }
+    }
+}
+
+// ============== Traffic Mix ==============
+// --appMix assigns an application to each STA (round-robin by STA id), each
+// entry <app>[@<ac>]:
+//   cbr   OnOff UDP at dataRate/packetSize (the original traffic)
+//   vbr   video-like UDP: bursts at twice dataRate, exponential on/off (mean 50 ms)
+//   voip  G.711-like UDP: 160 B every 20 ms during exponential talk spurts
+//   bulk  BulkSend TCP, as fast as the flow allows (--collector=flowmon)
+// The access category comes from the IP TOS of the flow (mapped to the user
+// priority by the socket); defaults: voip VO, vbr VI, cbr and bulk BE.
+std::string appMix = "cbr";
+
+enum AppType { APP_CBR, APP_VBR, APP_VOIP, APP_BULK };
+const char *appNames[] = {"cbr", "vbr", "voip", "bulk"};
+
+enum AccessCategory { AC_BE_INDEX, AC_BK_INDEX, AC_VI_INDEX, AC_VO_INDEX, NUM_ACS };
+const char *acNames[] = {"BE", "BK", "VI", "VO"};
+const uint8_t acTos[] = {0x00, 0x20, 0xa0, 0xc0}; // user priority 0, 1, 5, 6
+
+struct StaApp
+{
+    AppType app;
+    AccessCategory ac;
+};
+std::vector<StaApp> staApps;  // per STA
+bool acInUse[NUM_ACS] = {true, false, false, false};
+
+// "voip@vo" -> {APP_VOIP, AC_VO}; the AC defaults by application
+StaApp ParseAppSpec(const std::string &spec)
+{
+    std::string name = spec.substr(0, spec.find('@'));
+    StaApp result;
+    int app = -1;
+    for (int a = 0; a < 4; ++a) {
+        if (name == appNames[a]) {
+            app = a;
+        }
+    }
+    NS_ABORT_MSG_IF(app < 0, "Unknown application '" << name << "' (expected cbr, vbr, voip or bulk)");
+    result.app = (AppType)app;
+    result.ac = app == APP_VOIP ? AC_VO_INDEX : (app == APP_VBR ? AC_VI_INDEX : AC_BE_INDEX);
+    if (spec.find('@') != std::string::npos) {
+        std::string ac = spec.substr(spec.find('@') + 1);
+        std::transform(ac.begin(), ac.end(), ac.begin(), ::toupper);
+        int index = -1;
+        for (int c = 0; c < NUM_ACS; ++c) {
+            if (ac == acNames[c]) {
+                index = c;
+            }
+        }
+        NS_ABORT_MSG_IF(index < 0, "Unknown access category '" << ac << "' (expected be, bk, vi or vo)");
+        result.ac = (AccessCategory)index;
+    }
+    return result;
+}
+
+std::vector<StaApp> ParseAppMix(const std::string &mix)
+{
+    std::vector<StaApp> entries;
+    std::istringstream in(mix);
+    std::string spec;
+    while (std::getline(in, spec, ',')) {
+        if (!spec.empty()) {
+            entries.push_back(ParseAppSpec(spec));
+        }
+    }
+    NS_ABORT_MSG_IF(entries.empty(), "--appMix needs at least one application");
+    return entries;
+}
+
+// Anything but CBR on best effort for every STA
+bool MixedTraffic()
+{
+    for (uint32_t c = AC_BK_INDEX; c < NUM_ACS; ++c) {
+        if (acInUse[c]) {
+            return true;
+        }
+    }
+    for (size_t k = 0; k < staApps.size(); ++k) {
+        if (staApps[k].app != APP_CBR) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============== Latency Sketches ==============
+// --latencyPercentiles adds p50/p95/p99 of the one-way delay and of the
+// jitter (|delay change| between consecutive packets, RFC 3550 IPDV) per
+// flow and interval, fed from the packet receive traces. Each sketch is a
+// fixed HDR-style log-linear histogram: 32 sub-buckets per power of two from
+// 1 us to ~268 s, so a quantile is within ~1.6% of the true value and the
+// memory per flow does not depend on the packet count.
+bool latencyPercentiles = false;
+
+class QuantileSketch
+{
+public:
+    static const int subBuckets = 32;
+    static const int binades = 28;
+    static const int numBuckets = subBuckets * binades;
+    
+    QuantileSketch() : m_count(0), m_lo(numBuckets), m_hi(-1)
+    {
+        std::fill(m_counts, m_counts + numBuckets, 0u);
+    }
+    
+    void Add(double us)
+    {
+        int index = Index(us);
+        m_counts[index]++;
+        m_count++;
+        m_lo = std::min(m_lo, index);
+        m_hi = std::max(m_hi, index);
+    }
+    
+    // Value at quantile q (0..1), 0 when empty
+    double Quantile(double q) const
+    {
+        if (m_count == 0) {
+            return 0.0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * m_count));
+        uint64_t seen = 0;
+        for (int i = m_lo; i < m_hi; ++i) {
+            seen += m_counts[i];
+            if (seen >= rank) {
+                return Midpoint(i);
+            }
+        }
+        return Midpoint(m_hi);
+    }
+    
+    // Only the touched range is cleared
+    void Clear()
+    {
+        if (m_count > 0) {
+            std::fill(m_counts + m_lo, m_counts + m_hi + 1, 0u);
+        }
+        m_count = 0;
+        m_lo = numBuckets;
+        m_hi = -1;
+    }
+    
+private:
+    static int Index(double us)
+    {
+        if (us < 1.0) {
+            return 0;
+        }
+        int exponent;
+        double mantissa = std::frexp(us, &exponent); // us = mantissa * 2^exponent, mantissa in [0.5, 1)
+        int binade = exponent - 1;
+        if (binade >= binades) {
+            return numBuckets - 1;
+        }
+        return binade * subBuckets + (int)((mantissa - 0.5) * 2 * subBuckets);
+    }
+    
+    static double Midpoint(int index)
+    {
+        return std::ldexp(1.0 + (index % subBuckets + 0.5) / subBuckets, index / subBuckets);
+    }
+    
+    uint32_t m_counts[numBuckets];
+    uint64_t m_count;
+    int m_lo;
+    int m_hi;
+};
+
+struct FlowLatency
+{
+    FlowLatency() : lastDelayUs(0.0), havePrevious(false) {}
+    QuantileSketch delay;     // current interval
+    QuantileSketch jitter;
+    QuantileSketch runDelay;  // whole run, for the summary
+    QuantileSketch runJitter;
+    double lastDelayUs;
+    bool havePrevious;
+};
+std::vector<FlowLatency> flowLatency; // by STA id, sized only with --latencyPercentiles
+
+void RecordLatency(uint32_t sta, Time delay)
+{
+    FlowLatency &latency = flowLatency[sta];
+    double us = delay.GetSeconds() * 1e6;
+    latency.delay.Add(us);
+    latency.runDelay.Add(us);
+    if (latency.havePrevious) {
+        double ipdv = std::fabs(us - latency.lastDelayUs);
+        latency.jitter.Add(ipdv);
+        latency.runJitter.Add(ipdv);
+    }
+    latency.lastDelayUs = us;
+    latency.havePrevious = true;
+}
+
+// FlowMonitor collector: receive times for the sketches only
+void OnSinkRxLatency(Ptr<const Packet> packet, const Address &from, const Address &to,
+                     const SeqTsSizeHeader &header)
+{
+    Ipv4Address source = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    std::unordered_map<uint32_t, uint32_t>::const_iterator staIt = staByAddress.find(source.Get());
+    if (staIt != staByAddress.end()) {
+        RecordLatency(staIt->second, Simulator::Now() - header.GetTs());
+    }
+}
+
+// ============== Energy Accounting ==============
+// --energy installs a BasicEnergySource and a WifiRadioEnergyModel on every
+// AP and STA. The TX current follows the PHY's TX power
+// (LinearWifiTxCurrentModel), so the controller's power decisions show up in
+// the joules. The sources never deplete: this measures, it does not cut
+// radios off.
+bool energy = false;
+double supplyVoltage = 3.0; // V, BasicEnergySource default
+
+std::vector<Ptr<DeviceEnergyModel> > apRadios;  // by AP id
+std::vector<Ptr<DeviceEnergyModel> > staRadios; // by STA id
+std::vector<double> apEnergyMark;               // consumption at the previous sample
+std::vector<double> apEnergyInterval;           // joules of the AP's current sample
+std::vector<double> apEnergySampleTime;
+std::vector<double> staEnergyMark;              // consumption at the STA's previous row
+
+void SetupEnergy()
+{
+    if (!energy) {
+        return;
+    }
+    BasicEnergySourceHelper sourceHelper;
+    sourceHelper.Set("BasicEnergySourceInitialEnergyJ", DoubleValue(1e12));
+    sourceHelper.Set("BasicEnergySupplyVoltageV", DoubleValue(supplyVoltage));
+    WifiRadioEnergyModelHelper radioHelper;
+    radioHelper.SetTxCurrentModel("ns3::LinearWifiTxCurrentModel", "Voltage", DoubleValue(supplyVoltage));
+    
+    apRadios.resize(numAps);
+    staRadios.resize(stations.size());
+    for (uint32_t i = 0; i < numAps; ++i) {
+        EnergySourceContainer source = sourceHelper.Install(bss[i].apNode);
+        apRadios[i] = radioHelper.Install(bss[i].apDevice, source).Get(0);
+        for (uint32_t j = 0; j < bss[i].staDevices.GetN(); ++j) {
+            uint32_t sta = bss[i].firstSta + j;
+            EnergySourceContainer staSource = sourceHelper.Install(stations[sta].node);
+            staRadios[sta] = radioHelper.Install(bss[i].staDevices.Get(j), staSource.Get(0)).Get(0);
+        }
+    }
+    apEnergyMark.assign(numAps, 0.0);
+    apEnergyInterval.assign(numAps, 0.0);
+    apEnergySampleTime.assign(numAps, -1.0);
+    staEnergyMark.assign(stations.size(), 0.0);
+}
+
+// Joules the STA's radio used since its previous metrics row
+double TakeStaEnergy(uint32_t sta)
+{
+    double total = staRadios[sta]->GetTotalEnergyConsumption();
+    double used = total - staEnergyMark[sta];
+    staEnergyMark[sta] = total;
+    return used;
+}
+
+// Joules the AP's radio used over the sample at 'time'; every flow of the
+// BSS in that sample sees the same value
+double ApSampleEnergy(uint32_t ap, double time)
+{
+    if (apEnergySampleTime[ap] != time) {
+        double total = apRadios[ap]->GetTotalEnergyConsumption();
+        apEnergyInterval[ap] = total - apEnergyMark[ap];
+        apEnergyMark[ap] = total;
+        apEnergySampleTime[ap] = time;
+    }
+    return apEnergyInterval[ap];
+}
+
+void ResetEnergyMarks()
+{
+    for (uint32_t i = 0; i < apRadios.size(); ++i) {
+        apEnergyMark[i] = apRadios[i]->GetTotalEnergyConsumption();
+        apEnergySampleTime[i] = -1.0;
+    }
+    for (uint32_t k = 0; k < staRadios.size(); ++k) {
+        staEnergyMark[k] = staRadios[k]->GetTotalEnergyConsumption();
+    }
+}
+
+// ============== Metrics Sinks ==============
+// One row of the metrics stream
+struct MetricsRecord
+{
+    double time;
+    uint32_t sta;          // flow label index (stations[sta].label)
+    double distance;
+    double throughput;
+    double staEnergy;      // --energy only: STA radio joules since its previous row
+    double apEnergy;       // --energy only: AP radio joules over the sample
+    double bitsPerJoule;   // --energy only: delivered bits / (STA joules + the AP's per-STA share)
+    double pdr;
+    double loss;
+    double delay;
+    double rssi;
+    double snr;            // --rssiSource=phy only: EWMA SNR (dB)
+    double minRssi;        // --rssiSource=phy only: weakest recent frame (dBm)
+    double txPower;
+    double netThroughput;  // --channelMode=shared only: all flows of the sample (Mbps)
+    double trueDistance;   // --ftm only: ground truth behind the measured distance
+    double ftmAirtime;     // --ftm only: % of the interval spent on this STA's FTM frames
+    double delayBe;        // mixed traffic only: mean delay of each AC's flows in the sample (ms)
+    double delayBk;
+    double delayVi;
+    double delayVo;
+    double delayP50;       // --latencyPercentiles only: this interval's delay/jitter quantiles (ms)
+    double delayP95;
+    double delayP99;
+    double jitterP50;
+    double jitterP95;
+    double jitterP99;
+    uint64_t rxPackets;    // packets behind 'delay' (not written)
+    PowerAction decision;
+};
+
+double MetricsRecord::*const acDelayFields[NUM_ACS] = {
+    &MetricsRecord::delayBe, &MetricsRecord::delayBk, &MetricsRecord::delayVi, &MetricsRecord::delayVo};
+const char *acDelayColumns[NUM_ACS] = {"DelayBE(ms)", "DelayBK(ms)", "DelayVI(ms)", "DelayVO(ms)"};
+
+// Numeric columns between Flow and AI_Decision, in output order
+struct MetricsColumn
+{
+    const char *name;
+    int precision;  // decimals in the CSV
+    double MetricsRecord::*field;
+};
+
+std::vector<MetricsColumn> BuildMetricsColumns()
+{
+    std::vector<MetricsColumn> columns;
+    MetricsColumn base[] = {
+        {"Distance(m)", 2, &MetricsRecord::distance},
+        {"Throughput(Mbps)", 3, &MetricsRecord::throughput},
+        {"PDR(%)", 2, &MetricsRecord::pdr},
+        {"Loss(%)", 2, &MetricsRecord::loss},
+        {"Delay(ms)", 3, &MetricsRecord::delay},
+        {"RSSI(dBm)", 2, &MetricsRecord::rssi},
+        {"TxPower(dBm)", 1, &MetricsRecord::txPower},
+    };
+    columns.assign(base, base + sizeof(base) / sizeof(base[0]));
+    if (energy) {
+        // Next to the throughput they are judged against
+        MetricsColumn energyColumns[] = {
+            {"Energy(J)", 4, &MetricsRecord::staEnergy},
+            {"ApEnergy(J)", 4, &MetricsRecord::apEnergy},
+            {"Bits/J", 0, &MetricsRecord::bitsPerJoule},
+        };
+        columns.insert(columns.begin() + 2, energyColumns, energyColumns + 3);
+    }
+    if (rssiSource == "phy") {
+        MetricsColumn phyColumns[] = {
+            {"SNR(dB)", 2, &MetricsRecord::snr},
+            {"RSSIMin(dBm)", 2, &MetricsRecord::minRssi},
+        };
+        columns.insert(columns.end(), phyColumns, phyColumns + 2);
+    }
+    if (channelMode == "shared") {
+        MetricsColumn sharedColumn = {"NetThroughput(Mbps)", 3, &MetricsRecord::netThroughput};
+        columns.push_back(sharedColumn);
+    }
+    if (ftm) {
+        MetricsColumn ftmColumns[] = {
+            {"TrueDistance(m)", 2, &MetricsRecord::trueDistance},
+            {"FtmAirtime(%)", 3, &MetricsRecord::ftmAirtime},
+        };
+        columns.insert(columns.end(), ftmColumns, ftmColumns + 2);
+    }
+    if (latencyPercentiles) {
+        MetricsColumn latencyColumns[] = {
+            {"DelayP50(ms)", 3, &MetricsRecord::delayP50},
+            {"DelayP95(ms)", 3, &MetricsRecord::delayP95},
+            {"DelayP99(ms)", 3, &MetricsRecord::delayP99},
+            {"JitterP50(ms)", 3, &MetricsRecord::jitterP50},
+            {"JitterP95(ms)", 3, &MetricsRecord::jitterP95},
+            {"JitterP99(ms)", 3, &MetricsRecord::jitterP99},
+        };
+        columns.insert(columns.end(), latencyColumns, latencyColumns + 6);
+    }
+    if (MixedTraffic()) {
+        for (uint32_t c = 0; c < NUM_ACS; ++c) {
+            if (acInUse[c]) {
+                MetricsColumn acColumn = {acDelayColumns[c], 3, acDelayFields[c]};
+                columns.push_back(acColumn);
+            }
+        }
+    }
+    return columns;
+}
+
+class MetricsSink
+{
+public:
+    virtual ~MetricsSink() {}
+    virtual void Write(const MetricsRecord &record) = 0;
+    virtual void Close() = 0;
+};
+
+// CSV rows formatted into a large buffer and written in one fwrite when
+// the buffer passes the threshold, instead of a flush per row
+class CsvMetricsSink : public MetricsSink
+{
+public:
+    CsvMetricsSink(const std::string &path, const std::vector<MetricsColumn> &columns,
+                   const std::vector<std::string> &labels, size_t bufferBytes)
+        : m_columns(columns), m_labels(labels), m_threshold(bufferBytes)
+    {
+        m_file = std::fopen(path.c_str(), "w");
+        NS_ABORT_MSG_IF(m_file == 0, "Cannot open " << path);
+        m_buffer.reserve(bufferBytes + 1024);
+        m_buffer += "Time(s),Flow";
+        for (size_t c = 0; c < m_columns.size(); ++c) {
+            m_buffer += ",";
+            m_buffer += m_columns[c].name;
+        }
+        m_buffer += ",AI_Decision\n";
+    }
+    
+    ~CsvMetricsSink()
+    {
+        Close();
+    }
+    
+    void Write(const MetricsRecord &record)
+    {
+        char field[64];
+        std::snprintf(field, sizeof(field), "%.3f,", record.time);
+        m_buffer += field;
+        m_buffer += m_labels[record.sta];
+        for (size_t c = 0; c < m_columns.size(); ++c) {
+            std::snprintf(field, sizeof(field), ",%.*f", m_columns[c].precision,
+                          record.*(m_columns[c].field));
+            m_buffer += field;
+        }
+        m_buffer += ",";
+        m_buffer += powerActionNames[record.decision];
+        m_buffer += "\n";
+        if (m_buffer.size() >= m_threshold) {
+            Flush();
+        }
+    }
+    
+    void Close()
+    {
+        if (m_file) {
+            Flush();
+            std::fclose(m_file);
+            m_file = 0;
+        }
+    }
+    
+private:
+    void Flush()
+    {
+        std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+    
+    std::vector<MetricsColumn> m_columns;
+    std::vector<std::string> m_labels;
+    size_t m_threshold;
+    std::string m_buffer;
+    FILE *m_file;
+};
+
+// Fixed-width little-endian records behind a JSON schema header:
+//   "FTMMETR1" | uint32 version | uint32 schema length | schema JSON | pad to 8
+// followed by packed records: f8 time, u4 flow, one f4 per column, u1 decision.
+// ftm_ai_analyzer.py memory-maps the records with a numpy dtype built from the schema.
+class BinaryMetricsSink : public MetricsSink
+{
+public:
+    BinaryMetricsSink(const std::string &path, const std::vector<MetricsColumn> &columns,
+                      const std::vector<std::string> &labels, size_t bufferBytes)
+        : m_columns(columns), m_threshold(bufferBytes)
+    {
+        m_file = std::fopen(path.c_str(), "wb");
+        NS_ABORT_MSG_IF(m_file == 0, "Cannot open " << path);
+        m_buffer.reserve(bufferBytes + 256);
+        
+        std::ostringstream schema;
+        schema << "{\"columns\":[{\"name\":\"Time(s)\",\"type\":\"<f8\"},{\"name\":\"Flow\",\"type\":\"<u4\"}";
+        for (size_t c = 0; c < m_columns.size(); ++c) {
+            schema << ",{\"name\":\"" << m_columns[c].name << "\",\"type\":\"<f4\"}";
+        }
+        schema << ",{\"name\":\"AI_Decision\",\"type\":\"u1\"}],\"labels\":[";
+        for (size_t l = 0; l < labels.size(); ++l) {
+            schema << (l ? "," : "") << "\"" << labels[l] << "\"";
+        }
+        schema << "],\"decisions\":[";
+        for (uint32_t d = 0; d < NUM_POWER_ACTIONS; ++d) {
+            schema << (d ? "," : "") << "\"" << powerActionNames[d] << "\"";
+        }
+        schema << "]}";
+        
+        std::string json = schema.str();
+        json.append((8 - json.size() % 8) % 8, ' ');
+        uint32_t version = 1;
+        uint32_t length = json.size();
+        std::fwrite("FTMMETR1", 1, 8, m_file);
+        std::fwrite(&version, sizeof(version), 1, m_file);
+        std::fwrite(&length, sizeof(length), 1, m_file);
+        std::fwrite(json.data(), 1, json.size(), m_file);
+    }
+    
+    ~BinaryMetricsSink()
+    {
+        Close();
+    }
+    
+    void Write(const MetricsRecord &record)
+    {
+        Append(&record.time, sizeof(record.time));
+        Append(&record.sta, sizeof(record.sta));
+        for (size_t c = 0; c < m_columns.size(); ++c) {
+            float value = record.*(m_columns[c].field);
+            Append(&value, sizeof(value));
+        }
+        uint8_t decision = record.decision;
+        Append(&decision, sizeof(decision));
+        if (m_buffer.size() >= m_threshold) {
+            Flush();
+        }
+    }
+    
+    void Close()
+    {
+        if (m_file) {
+            Flush();
+            std::fclose(m_file);
+            m_file = 0;
+        }
+    }
+    
+private:
+    void Append(const void *data, size_t size)
+    {
+        const char *bytes = static_cast<const char *>(data);
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+    }
+    
+    void Flush()
+    {
+        std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
+    }
+    
+    std::vector<MetricsColumn> m_columns;
+    size_t m_threshold;
+    std::vector<char> m_buffer;
+    FILE *m_file;
+};
+
+std::unique_ptr<MetricsSink> metricsSink;
+
+// Per-flow accumulators of the current --rolloverInterval window
+struct WindowStats
+{
+    uint32_t samples;
+    double throughput;
+    double pdr;
+    double delay;
+    double rssi;
+    double txPower;
+    uint32_t powerChanges; // non-maintain decisions
+};
+std::vector<WindowStats> windowStats; // indexed by STA id
+FILE *windowFile = 0;
+double windowStart = 2.0;
+
+void AccumulateWindow(const MetricsRecord &record)
+{
+    if (!windowFile) {
+        return;
+    }
+    WindowStats &w = windowStats[record.sta];
+    w.samples++;
+    w.throughput += record.throughput;
+    w.pdr += record.pdr;
+    w.delay += record.delay;
+    w.rssi += record.rssi;
+    w.txPower += record.txPower;
+    w.powerChanges += (record.decision != ACTION_MAINTAIN);
+}
+
+// Records of the current sample, and the observations of the links the
+// controller acts on (mobile BSSs); pendingLinks[i] is the record index
+std::vector<MetricsRecord> pendingRecords;
+std::vector<LinkObservation> pendingObservations;
+std::vector<uint32_t> pendingLinks;
+std::vector<PowerAction> pendingActions;
+
+// Turn one flow's per-interval counters into metrics and queue them for the
+// controller tick
+void ProcessFlowSample(double time, double interval, uint32_t sta, const FlowCounters &delta)
+{
+    double throughput = (interval > 0) ? 
+        (delta.rxBytes * 8.0 / interval) / 1e6 : 0.0; // Mbps
+    double pdr = (delta.txPackets > 0) ? 
+        (double)delta.rxPackets / delta.txPackets * 100.0 : 0.0;
+    double loss = 100.0 - pdr;
+    double delay = (delta.rxPackets > 0) ? 
+        (delta.delaySum.GetSeconds() / delta.rxPackets) * 1000.0 : 0.0;
+    
+    // Determine which AP/STA pair
+    uint32_t ap = stations[sta].ap;
+    double currentPower = bss[ap].txPower;
+    
+    // Calculate distance (FTM range when enabled) and RSSI
+    double trueDistance = geometry.serving[sta];
+    double distance = MeasuredRange(sta, trueDistance);
+    double rssi = (rssiSource == "logdistance") ? currentPower - geometry.servingLoss[sta]
+                                                : CalculateRSSI(trueDistance, currentPower);
+    double snr = 0.0;
+    double minRssi = rssi;
+    if (rssiSource == "phy" && linkQuality[sta].count > 0) {
+        // Nothing received yet keeps the analytic estimate
+        rssi = linkQuality[sta].ewmaSignal;
+        snr = linkQuality[sta].ewmaSnr;
+        minRssi = RecentMinRssi(sta);
+    }
+    
+    MetricsRecord record;
+    record.time = time;
+    record.sta = sta;
+    record.distance = distance;
+    record.throughput = throughput;
+    record.pdr = pdr;
+    record.loss = loss;
+    record.delay = delay;
+    record.rssi = rssi;
+    record.snr = snr;
+    record.minRssi = minRssi;
+    record.txPower = currentPower;
+    record.trueDistance = trueDistance;
+    record.ftmAirtime = ftm ? TakeFtmAirtime(sta) : 0.0;
+    record.rxPackets = delta.rxPackets;
+    if (energy) {
+        record.staEnergy = TakeStaEnergy(sta);
+        record.apEnergy = ApSampleEnergy(ap, time);
+        double joules = record.staEnergy + record.apEnergy / bss[ap].staDevices.GetN();
+        record.bitsPerJoule = joules > 0 ? delta.rxBytes * 8.0 / joules : 0.0;
+    }
+    if (latencyPercentiles) {
+        FlowLatency &latency = flowLatency[sta];
+        record.delayP50 = latency.delay.Quantile(0.50) / 1000.0;
+        record.delayP95 = latency.delay.Quantile(0.95) / 1000.0;
+        record.delayP99 = latency.delay.Quantile(0.99) / 1000.0;
+        record.jitterP50 = latency.jitter.Quantile(0.50) / 1000.0;
+        record.jitterP95 = latency.jitter.Quantile(0.95) / 1000.0;
+        record.jitterP99 = latency.jitter.Quantile(0.99) / 1000.0;
+        latency.delay.Clear();
+        latency.jitter.Clear();
+    }
+    record.decision = ACTION_MAINTAIN;
+    
+    // AI Decision (only for BSSs with mobile STAs, every BSS when coordinated)
+    if (bss[ap].mobile || coordinator == "joint") {
+        LinkObservation obs;
+        obs.ap = ap;
+        obs.sta = sta;
+        obs.distance = distance;
+        obs.throughput = throughput;
+        obs.pdr = pdr;
+        obs.delay = delay;
+        obs.rssi = rssi;
+        obs.txPower = currentPower;
+        pendingObservations.push_back(obs);
+        pendingLinks.push_back(pendingRecords.size());
+    }
+    pendingRecords.push_back(record);
+}
+
+// Score all queued links in one policy call, apply the decisions and write
+// the metrics rows in collection order
+void RunControlTick()
+{
+    // Aggregate throughput of the tick: with a shared channel a louder AP
+    // costs its neighbours throughput, so the controller holds an AP whose
+    // last increase lowered it, and the bridge/AI policies see it too
+    controlTick++;
+    double networkThroughput = 0.0;
+    for (size_t r = 0; r < pendingRecords.size(); ++r) {
+        networkThroughput += pendingRecords[r].throughput;
+    }
+    // Per-AC latency: packet-weighted mean delay of each category's flows
+    double acDelaySum[NUM_ACS] = {0.0, 0.0, 0.0, 0.0};
+    uint64_t acPackets[NUM_ACS] = {0, 0, 0, 0};
+    for (size_t r = 0; r < pendingRecords.size(); ++r) {
+        AccessCategory ac = staApps[pendingRecords[r].sta].ac;
+        acDelaySum[ac] += pendingRecords[r].delay * pendingRecords[r].rxPackets;
+        acPackets[ac] += pendingRecords[r].rxPackets;
+    }
+    for (size_t r = 0; r < pendingRecords.size(); ++r) {
+        pendingRecords[r].netThroughput = networkThroughput;
+        for (uint32_t c = 0; c < NUM_ACS; ++c) {
+            pendingRecords[r].*acDelayFields[c] = acPackets[c] ? acDelaySum[c] / acPackets[c] : 0.0;
+        }
+    }
+    for (size_t i = 0; i < pendingObservations.size(); ++i) {
+        pendingObservations[i].networkThroughput = networkThroughput;
+    }
+    
+    {
+        ProfileScope profile(decisionProfile);
+        powerPolicy->DecideBatch(pendingObservations, pendingActions);
+    }
+    // One actuation per AP; every link row records its AP's action
+    if (coordinator == "joint") {
+        CoordinatePower(pendingObservations, pendingActions);
+    } else {
+        ReduceToApDemands(pendingObservations, pendingActions);
+    }
+    if (channelMode == "shared") {
+        for (uint32_t ap = 0; ap < numAps; ++ap) {
+            if (apDemands[ap].links > 0 && WantsMorePower(apDemands[ap].action) &&
+                HoldAfterBoost(ap, networkThroughput)) {
+                apDemands[ap].action = ACTION_MAINTAIN;
+            }
+        }
+    }
+    for (size_t i = 0; i < pendingObservations.size(); ++i) {
+        pendingRecords[pendingLinks[i]].decision = apDemands[pendingObservations[i].ap].action;
+    }
+    for (uint32_t ap = 0; ap < numAps; ++ap) {
+        if (apDemands[ap].links > 0) {
+            ActuateAp(apDemands[ap].action, ap, thresholds.targetThroughput - apDemands[ap].shortfall);
+        }
+    }
+    for (size_t r = 0; r < pendingRecords.size(); ++r) {
+        metricsSink->Write(pendingRecords[r]);
+        AccumulateWindow(pendingRecords[r]);
+    }
+    pendingRecords.clear();
+    pendingObservations.clear();
+    pendingLinks.clear();
+}
+
+// Poll FlowMonitor: one pass over the stats (by const reference, no copy)
+void CollectFlowMonitorSamples(double time, double interval)
+{
+    monitor->CheckForLostPackets();
+    const FlowMonitor::FlowStatsContainer &stats = monitor->GetFlowStats();
+    
+    for (FlowMonitor::FlowStatsContainer::const_iterator iter = stats.begin(); 
+         iter != stats.end(); ++iter) {
+        FlowId fid = iter->first;
+        const FlowRecord &flow = LookupFlow(fid);
+        
+        if (flow.tracked) {
+            
+            // Calculate delta metrics
+            if (fid >= lastFlowState.size()) {
+                lastFlowState.resize(fid + 1);
+            }
+            FlowCounters &last = lastFlowState[fid];
+            const FlowMonitor::FlowStats &cur = iter->second;
+            
+            FlowCounters delta;
+            delta.rxBytes = (cur.rxBytes >= last.rxBytes) ? 
+                (cur.rxBytes - last.rxBytes) : cur.rxBytes;
+            delta.txPackets = (cur.txPackets >= last.txPackets) ? 
+                (cur.txPackets - last.txPackets) : cur.txPackets;
+            delta.rxPackets = (cur.rxPackets >= last.rxPackets) ? 
+                (cur.rxPackets - last.rxPackets) : cur.rxPackets;
+            delta.delaySum = (cur.delaySum >= last.delaySum) ? 
+                (cur.delaySum - last.delaySum) : cur.delaySum;
+            
+            ProcessFlowSample(time, interval, flow.sta, delta);
+            
+            // Update last state
+            last.rxBytes = cur.rxBytes;
+            last.txPackets = cur.txPackets;
+            last.rxPackets = cur.rxPackets;
+            last.delaySum = cur.delaySum;
+        }
+    }
+}
+
+// ============== Trace Collector ==============
+void MarkDirty(uint32_t sta)
+{
+    if (!intervalDirty[sta]) {
+        intervalDirty[sta] = 1;
+        dirtyStations.push_back(sta);
+    }
+}
+
+void OnClientTx(uint32_t sta, Ptr<const Packet> packet)
+{
+    intervalCounters[sta].txPackets++;
+    MarkDirty(sta);
+}
+
+void OnSinkRx(Ptr<const Packet> packet, const Address &from, const Address &to,
+              const SeqTsSizeHeader &header)
+{
+    Ipv4Address source = InetSocketAddress::ConvertFrom(from).GetIpv4();
+    std::unordered_map<uint32_t, uint32_t>::const_iterator staIt = staByAddress.find(source.Get());
+    if (staIt == staByAddress.end()) {
+        return;
+    }
+    FlowCounters &counters = intervalCounters[staIt->second];
+    counters.rxBytes += header.GetSize() + ipUdpOverhead;
+    counters.rxPackets++;
+    counters.delaySum += Simulator::Now() - header.GetTs();
+    if (latencyPercentiles) {
+        RecordLatency(staIt->second, Simulator::Now() - header.GetTs());
+    }
+    MarkDirty(staIt->second);
+}
+
+// --collector=ap: uplink packets as the AP IP layer receives them
+void OnApIpRx(Ptr<const Packet> packet, Ptr<Ipv4> ipv4, uint32_t interface)
+{
+    Ipv4Header ipHeader;
+    packet->PeekHeader(ipHeader);
+    std::unordered_map<uint32_t, uint32_t>::const_iterator staIt = staByAddress.find(ipHeader.GetSource().Get());
+    if (staIt == staByAddress.end() || ipHeader.GetProtocol() != 17) {
+        return;
+    }
+    // The send timestamp sits behind the IP and UDP headers: SeqTsSizeHeader
+    // serializes seq (4 bytes) then the timestamp (8 bytes, network order).
+    // Read just those bytes into a stack buffer instead of copying the packet
+    const uint32_t udpBytes = 8;
+    const uint32_t seqBytes = 4;
+    uint8_t bytes[60 + udpBytes + seqBytes + 8]; // up to 60 bytes of IPv4 header
+    uint32_t tsOffset = ipHeader.GetSerializedSize() + udpBytes + seqBytes;
+    if (packet->CopyData(bytes, tsOffset + 8) < tsOffset + 8) {
+        return;
+    }
+    uint64_t ts = 0;
+    for (uint32_t b = 0; b < 8; ++b) {
+        ts = (ts << 8) | bytes[tsOffset + b];
+    }
+    Time delay = Simulator::Now() - TimeStep(ts);
+    
+    FlowCounters &counters = intervalCounters[staIt->second];
+    counters.rxBytes += packet->GetSize();
+    counters.rxPackets++;
+    counters.delaySum += delay;
+    if (latencyPercentiles) {
+        RecordLatency(staIt->second, delay);
+    }
+    MarkDirty(staIt->second);
+}
+
+// Only flows that sent or received something since the last sample are
+// visited, so a sample costs O(changed flows)
+void CollectTraceSamples(double time, double interval)
+{
+    for (uint32_t k = 0; k < dirtyStations.size(); ++k) {
+        uint32_t sta = dirtyStations[k];
+        const FlowCounters &counters = intervalCounters[sta];
+        ProcessFlowSample(time, interval, sta, counters);
+        FlowCounters &total = runCounters[sta];
+        total.rxBytes += counters.rxBytes;
+        total.txPackets += counters.txPackets;
+        total.rxPackets += counters.rxPackets;
+        total.delaySum += counters.delaySum;
+        intervalCounters[sta] = FlowCounters();
+        intervalDirty[sta] = 0;
+    }
+    dirtyStations.clear();
+}
+
+// ============== FlowMonitor Stream ==============
+// --flowmonOutput=jsonl appends one compact JSON line per flow that changed
+// since the previous snapshot, every flowmonStreamInterval, plus a final
+// snapshot of every flow. Nothing is built up for the end of the run, so
+// shutdown cost stays flat as the flow count grows.
+FILE *flowmonStream = 0;
+std::vector<uint64_t> flowmonStreamSeen; // tx+rx+lost packets at the last line, by FlowId
+
+void WriteFlowStreamSnapshot(bool final)
+{
+    monitor->CheckForLostPackets();
+    double now = Simulator::Now().GetSeconds();
+    const FlowMonitor::FlowStatsContainer &stats = monitor->GetFlowStats();
+    for (FlowMonitor::FlowStatsContainer::const_iterator iter = stats.begin();
+         iter != stats.end(); ++iter) {
+        FlowId fid = iter->first;
+        const FlowMonitor::FlowStats &st = iter->second;
+        uint64_t seen = (uint64_t)st.txPackets + st.rxPackets + st.lostPackets;
+        if (fid >= flowmonStreamSeen.size()) {
+            flowmonStreamSeen.resize(fid + 1, std::numeric_limits<uint64_t>::max());
+        }
+        if (!final && flowmonStreamSeen[fid] == seen) {
+            continue;
+        }
+        flowmonStreamSeen[fid] = seen;
+        
+        const FlowRecord &flow = LookupFlow(fid);
+        std::fprintf(flowmonStream,
+                     "{\"t\":%.3f,\"flow\":%u,\"label\":\"%s\",\"txPackets\":%u,\"rxPackets\":%u,"
+                     "\"lostPackets\":%u,\"txBytes\":%llu,\"rxBytes\":%llu,\"delaySum_ms\":%.6f,"
+                     "\"jitterSum_ms\":%.6f,\"timesForwarded\":%u%s}\n",
+                     now, (unsigned)fid, flow.label.c_str(), st.txPackets, st.rxPackets,
+                     st.lostPackets, (unsigned long long)st.txBytes, (unsigned long long)st.rxBytes,
+                     st.delaySum.GetSeconds() * 1000.0, st.jitterSum.GetSeconds() * 1000.0,
+                     st.timesForwarded, final ? ",\"final\":true" : "");
+    }
+}
+
+void StreamFlowStats()
+{
+    WriteFlowStreamSnapshot(false);
+    Simulator::Schedule(Seconds(flowmonStreamInterval), &StreamFlowStats);
+}
+
+// Each output part starts with a line for every flow
+void OpenFlowStreamFile()
+{
+    std::string path = OutputPath(PartName("ftm-flowmon-stream", "jsonl"));
+    flowmonStream = std::fopen(path.c_str(), "w");
+    NS_ABORT_MSG_IF(flowmonStream == 0, "Cannot open " << path);
+    std::setvbuf(flowmonStream, 0, _IOFBF, metricsBufferKb * 1024);
+    flowmonStreamSeen.assign(flowmonStreamSeen.size(), std::numeric_limits<uint64_t>::max());
+}
+
+void OpenFlowStream(double start)
+{
+    if (flowmonOutput != "jsonl") {
+        return;
+    }
+    OpenFlowStreamFile();
+    Simulator::Schedule(Seconds(start), &StreamFlowStats);
+}
+
+void CloseFlowStream()
+{
+    if (flowmonStream) {
+        WriteFlowStreamSnapshot(true);
+        std::fclose(flowmonStream);
+        flowmonStream = 0;
+    }
+}
+
+// ============== Long Runs ==============
+// --rolloverInterval splits a long (e.g. 24 h) run into parts: every
+// interval the metrics file and the FlowMonitor stream move on to a new
+// numbered file, and one summary row per flow for the window just closed
+// goes to ftm_windows.csv. Per-flow state is fixed-size (delta trackers
+// by FlowId, window accumulators by STA), so memory does not grow with
+// simulated time.
+void WriteWindowSummary(double end)
+{
+    for (uint32_t sta = 0; sta < windowStats.size(); ++sta) {
+        const WindowStats &w = windowStats[sta];
+        if (w.samples == 0) {
+            continue;
+        }
+        std::fprintf(windowFile, "%.3f,%.3f,%s,%u,%.3f,%.2f,%.3f,%.2f,%.1f,%u\n",
+                     windowStart, end, stations[sta].label.c_str(), w.samples,
+                     w.throughput / w.samples, w.pdr / w.samples, w.delay / w.samples,
+                     w.rssi / w.samples, w.txPower / w.samples, w.powerChanges);
+    }
+    std::fflush(windowFile);
+    windowStats.assign(windowStats.size(), WindowStats());
+    windowStart = end;
+}
+
+void OpenMetricsOutput()
+{
+    std::vector<std::string> labels;
+    for (uint32_t k = 0; k < stations.size(); ++k) {
+        labels.push_back(stations[k].label);
+    }
+    size_t bufferBytes = (size_t)metricsBufferKb * 1024;
+    if (metricsFormat == "binary") {
+        metricsSink.reset(new BinaryMetricsSink(OutputPath(PartName("ftm_metrics", "bin")), BuildMetricsColumns(),
+                                                labels, bufferBytes));
+    } else {
+        metricsSink.reset(new CsvMetricsSink(OutputPath(PartName("ftm_metrics", "csv")), BuildMetricsColumns(),
+                                             labels, bufferBytes));
+    }
+}
+
+void OpenWindowOutput(double start)
+{
+    if (rolloverInterval <= 0) {
+        return;
+    }
+    std::string path = OutputPath("ftm_windows.csv");
+    windowFile = std::fopen(path.c_str(), "w");
+    NS_ABORT_MSG_IF(windowFile == 0, "Cannot open " << path);
+    std::fprintf(windowFile, "WindowStart(s),WindowEnd(s),Flow,Samples,Throughput(Mbps),PDR(%%),"
+                 "Delay(ms),RSSI(dBm),TxPower(dBm),PowerChanges\n");
+    windowStats.assign(stations.size(), WindowStats());
+    windowStart = start;
+}
+
+// Close the current window and move every output file on to the next part
+void RollOver(double time)
+{
+    WriteWindowSummary(time);
+    metricsSink->Close();
+    if (flowmonStream) {
+        std::fclose(flowmonStream);
+        flowmonStream = 0;
+    }
+    outputPart++;
+    OpenMetricsOutput();
+    if (flowmonOutput == "jsonl") {
+        OpenFlowStreamFile();
+    }
+}
+
+void CloseWindowOutput()
+{
+    if (windowFile) {
+        WriteWindowSummary(lastSampleTime.GetSeconds());
+        std::fclose(windowFile);
+        windowFile = 0;
+    }
+}
+
+// ============== Warm Start ==============
+// --warmRuns=N measures seeds RngRun .. RngRun+N-1 back to back in one
+// process: the topology, addressing, routing, association and Minstrel
+// rate tables are built once, and later episodes start from that warm
+// state after an --episodeGap drain instead of a fresh setup. Each
+// episode times [2 s, simTime] as usual (shifted), writes its metrics to
+// <outputDir>/run-<RngRun>/, and starts with reseeded random streams,
+// initial TX power and channel plan, and a fresh sampling baseline.
+uint32_t warmRuns = 0;           // > 0: episodes per process
+double episodeGap = 1.0;         // s between one episode's end and the next start
+uint32_t episode = 0;            // current episode
+uint64_t firstRun = 1;           // RngRun of episode 0
+double episodeEnd = 20.0;        // s, last sample of the current episode
+std::string baseOutputDir;
+NodeContainer warmNodes;         // everything AssignStreams must reach
+NetDeviceContainer warmWifiDevices;
+
+uint32_t NumEpisodes()
+{
+    return std::max(1u, warmRuns);
+}
+
+// Episodes are at least as long as the 20 s waypoint pattern,
+// so each mobile STA replays the same path
+double EpisodePeriod()
+{
+    return std::max(simTime, 20.0) - 2.0 + episodeGap;
+}
+
+double EpisodeOffset(uint32_t k)
+{
+    return k * EpisodePeriod();
+}
+
+// Same stream indices every episode; the run number picks the substreams
+void ReseedStreams(uint64_t run)
+{
+    RngSeedManager::SetRun(run);
+    int64_t stream = 1;
+    WifiHelper wifiHelper;
+    stream += wifiHelper.AssignStreams(warmWifiDevices, stream);
+    MobilityHelper mobilityHelper;
+    stream += mobilityHelper.AssignStreams(warmNodes, stream);
+    InternetStackHelper stackHelper;
+    stream += stackHelper.AssignStreams(warmNodes, stream);
+    OnOffHelper onoffHelper("ns3::UdpSocketFactory", Address());
+    stream += onoffHelper.AssignStreams(warmNodes, stream);
+    if (ftmError) {
+        ftmError->SetStream(stream++);
+    }
+}
+
+// Drop whatever the flows did since the last sample (the drain gap)
+void ResetSamplingBaseline()
+{
+    ResetEnergyMarks();
+    for (size_t k = 0; k < flowLatency.size(); ++k) {
+        flowLatency[k].delay.Clear();
+        flowLatency[k].jitter.Clear();
+        flowLatency[k].havePrevious = false;
+    }
+    if (collector != "flowmon") {
+        for (uint32_t k = 0; k < dirtyStations.size(); ++k) {
+            intervalCounters[dirtyStations[k]] = FlowCounters();
+            intervalDirty[dirtyStations[k]] = 0;
+        }
+        dirtyStations.clear();
+        return;
+    }
+    monitor->CheckForLostPackets();
+    const FlowMonitor::FlowStatsContainer &stats = monitor->GetFlowStats();
+    for (FlowMonitor::FlowStatsContainer::const_iterator iter = stats.begin();
+         iter != stats.end(); ++iter) {
+        if (iter->first >= lastFlowState.size()) {
+            lastFlowState.resize(iter->first + 1);
+        }
+        FlowCounters &last = lastFlowState[iter->first];
+        last.rxBytes = iter->second.rxBytes;
+        last.txPackets = iter->second.txPackets;
+        last.rxPackets = iter->second.rxPackets;
+        last.delaySum = iter->second.delaySum;
+    }
+}
+
+void RecordMetrics();
+
+void OpenEpisodeOutput(uint32_t k)
+{
+    if (warmRuns == 0) {
+        return;
+    }
+    std::ostringstream dir;
+    dir << baseOutputDir << "/run-" << firstRun + k;
+    outputDir = dir.str();
+    CreateResultFolder();
+}
+
+void BeginEpisode(uint32_t k)
+{
+    episode = k;
+    episodeEnd = simTime + EpisodeOffset(k);
+    controlTick = 0;
+    ReseedStreams(firstRun + k);
+    for (uint32_t i = 0; i < numAps; ++i) {
+        SetApTxPower(i, initialTxPower);
+        uint8_t initialChannel = channelPool[i % channelPool.size()];
+        if (bss[i].channel != initialChannel) {
+            bss[i].apPhy->SetChannelNumber(initialChannel);
+            for (uint32_t j = 0; j < bss[i].staDevices.GetN(); ++j) {
+                DynamicCast<WifiNetDevice>(bss[i].staDevices.Get(j))->GetPhy()->SetChannelNumber(initialChannel);
+            }
+            bss[i].channel = initialChannel;
+        }
+        bss[i].lastChannelSwitch = Simulator::Now();
+        bss[i].lastActuation = Simulator::Now();
+        bss[i].actuations = 0;
+        bss[i].channelSwitches = 0;
+        bss[i].boostTick = 0;
+    }
+    
+    OpenEpisodeOutput(k);
+    OpenMetricsOutput();
+    OpenWindowOutput(Simulator::Now().GetSeconds());
+    ResetSamplingBaseline();
+    lastSampleTime = Simulator::Now();
+    NS_LOG_INFO("Warm start: episode " << k + 1 << "/" << NumEpisodes() << " (RngRun " << firstRun + k << ")");
+    // The first sample one interval in, as in a cold run (whose t=2 sample
+    // has no flows yet); sampling now would write a zero-length interval
+    Simulator::Schedule(Seconds(std::min(NextSampleInterval(), episodeEnd - Simulator::Now().GetSeconds())),
+                        &RecordMetrics);
+}
+
+void FinishEpisode()
+{
+    WriteActuationReport();
+    CloseWindowOutput();
+    metricsSink->Close();
+}
+
+// ============== Sampling Loop ==============
+void RecordMetrics()
+{
+    ProfileScope profile(recordMetricsProfile);
+    double time = Simulator::Now().GetSeconds();
+    double interval = (Simulator::Now() - lastSampleTime).GetSeconds();
+    lastSampleTime = Simulator::Now();
+    
+    RefreshLinkGeometry(coordinator == "joint" && channelMode == "shared");
+    if (collector != "flowmon") {
+        CollectTraceSamples(time, interval);
+    } else {
+        CollectFlowMonitorSamples(time, interval);
+    }
+    RunControlTick();
+    
+    if (windowFile && time >= windowStart + rolloverInterval && time < episodeEnd) {
+        RollOver(time);
+    }
+    
+    if (time < episodeEnd) {
+        // Land the last sample exactly on the episode end
+        double next = std::min(NextSampleInterval(), episodeEnd - time);
+        Simulator::Schedule(Seconds(next), &RecordMetrics);
+    } else if (episode + 1 < NumEpisodes()) {
+        FinishEpisode();
+        Simulator::Schedule(Seconds(2.0 + EpisodeOffset(episode + 1) - time), &BeginEpisode, episode + 1);
+    }
+}
+
+// ============== Packet Capture ==============
+// Windowed/truncated captures hook the AP PHY sniffer traces directly and
+// write 802.11 frames (no radiotap) through a PcapFileWrapper that is only
+// created when the first frame inside a window arrives
+struct PcapCapture
+{
+    std::string fileName;
+    Ptr<PcapFileWrapper> file;
+};
+std::vector<PcapCapture> pcapCaptures; // indexed by AP id
+uint32_t pcapOpenWindows = 0;          // > 0 while inside a capture window
 
-// WiFi PHY helpers for dynamic adjustment
-YansWifiPhyHelper phy1_global;
-YansWifiPhyHelper phy2_global;
+void SetPcapWindow(bool open)
+{
+    if (open) {
+        pcapOpenWindows++;
+    } else if (pcapOpenWindows > 0) {
+        pcapOpenWindows--;
+    }
+}
 
-// ============== Helper Functions ==============
-void CreateResultFolder()
+void WritePcapFrame(uint32_t ap, Ptr<const Packet> packet)
 {
-    struct stat info;
-    if (stat("result", &info) != 0) {
-        mkdir("result", 0755);
+    if (pcapOpenWindows == 0) {
+        return;
+    }
+    PcapCapture &capture = pcapCaptures[ap];
+    if (!capture.file) {
+        PcapHelper pcapHelper;
+        capture.file = pcapHelper.CreateFile(capture.fileName, std::ios::out,
+                                             PcapHelper::DLT_IEEE802_11, pcapSnaplen);
     }
+    capture.file->Write(Simulator::Now(), packet);
 }
 
-double CalculateDistance(Ptr<Node> node1, Ptr<Node> node2)
+void OnPcapSnifferRx(uint32_t ap, Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                     WifiTxVector txVector, MpduInfo aMpdu, SignalNoiseDbm signalNoise,
+                     uint16_t staId)
 {
-    Ptr<MobilityModel> mob1 = node1->GetObject<MobilityModel>();
-    Ptr<MobilityModel> mob2 = node2->GetObject<MobilityModel>();
-    return mob1->GetDistanceFrom(mob2);
+    WritePcapFrame(ap, packet);
 }
 
-double CalculateRSSI(double distance, double txPower)
+void OnPcapSnifferTx(uint32_t ap, Ptr<const Packet> packet, uint16_t channelFreqMhz,
+                     WifiTxVector txVector, MpduInfo aMpdu, uint16_t staId)
 {
-    // Friis propagation model at 5GHz
-    double frequency = 5.0; // GHz
-    double pathLoss = 20 * log10(distance) + 20 * log10(frequency) + 32.44;
-    return txPower - pathLoss;
+    WritePcapFrame(ap, packet);
 }
 
-std::string ExecuteAIDecision(double distance, double throughput, double rssi)
+void SetupPcap(YansWifiPhyHelper &phy)
 {
-    std::string decision = "maintain";
-    double targetThroughput = 4.5; // Target 90% of 5Mbps
+    if (pcapMode == "off") {
+        return;
+    }
+    
+    std::vector<bool> selected(numAps, pcapAps.empty());
+    std::vector<std::string> apList = SplitList(pcapAps, ',');
+    for (size_t k = 0; k < apList.size(); ++k) {
+        uint32_t apNumber = std::atoi(apList[k].c_str());
+        NS_ABORT_MSG_IF(apNumber < 1 || apNumber > numAps, "pcapAps: no AP" << apList[k]);
+        selected[apNumber - 1] = true;
+    }
+    
+    // Whole-run full captures keep the helper's radiotap output
+    if (pcapMode == "full" && pcapWindows.empty()) {
+        for (uint32_t i = 0; i < numAps; ++i) {
+            if (selected[i]) {
+                std::ostringstream prefix;
+                prefix << OutputPath("ftm-ap") << i + 1;
+                phy.EnablePcap(prefix.str(), bss[i].apDevice.Get(0), true, true);
+            }
+        }
+        return;
+    }
     
-    // CRITICAL: Check distance and RSSI first (most important)
-    if (distance > 15.0 || rssi < -65.0) {
-        decision = "increase_power"; // Far distance or weak signal
-    } 
-    else if (distance > 10.0 || rssi < -60.0) {
-        if (throughput < targetThroughput * 0.9) {
-            decision = "increase_power"; // Medium distance with degraded throughput
+    if (pcapMode == "full") {
+        pcapSnaplen = 65535;
+    }
+    pcapCaptures.resize(numAps);
+    for (uint32_t i = 0; i < numAps; ++i) {
+        if (!selected[i]) {
+            continue;
         }
-    } 
-    else if (distance < 7.0 && rssi > -50.0 && throughput > targetThroughput) {
-        decision = "decrease_power"; // Very close with excellent signal - save energy
+        std::ostringstream prefix;
+        prefix << OutputPath("ftm-ap") << i + 1;
+        PcapHelper pcapHelper;
+        pcapCaptures[i].fileName = pcapHelper.GetFilenameFromDevice(prefix.str(), bss[i].apDevice.Get(0));
+        bss[i].apPhy->TraceConnectWithoutContext("MonitorSnifferRx", MakeBoundCallback(&OnPcapSnifferRx, i));
+        bss[i].apPhy->TraceConnectWithoutContext("MonitorSnifferTx", MakeBoundCallback(&OnPcapSnifferTx, i));
     }
     
-    return decision;
+    std::vector<std::string> windows = SplitList(pcapWindows, ',');
+    if (windows.empty()) {
+        SetPcapWindow(true);
+    }
+    for (size_t w = 0; w < windows.size(); ++w) {
+        size_t dash = windows[w].find('-');
+        NS_ABORT_MSG_IF(dash == std::string::npos, "pcapWindows: expected start-stop, got " << windows[w]);
+        double start = std::atof(windows[w].substr(0, dash).c_str());
+        double stop = std::atof(windows[w].substr(dash + 1).c_str());
+        NS_ABORT_MSG_IF(stop <= start, "pcapWindows: empty window " << windows[w]);
+        Simulator::Schedule(Seconds(start), &SetPcapWindow, true);
+        Simulator::Schedule(Seconds(stop), &SetPcapWindow, false);
+    }
+}
+
+// ============== Scenario File ==============
+// --scenario=<file> describes a run in one text file ('#' starts a comment):
+//   set <option> <value>             any command-line option (the command line still wins)
+//   traffic <who> <dataRate> <packetSize> [<onTime> <offTime>]
+//                                    who = * | ap<N> (1-based AP) | sta<K> (STA id)
+//   app <who> <app>[@<ac>]           application of the selected STAs (see --appMix)
+//   waypoint <sta> <time> <x> <y>    inline path of one STA (short paths)
+//   mobility ns2 <file>              ns-2 mobility trace, $node_(K) = STA id K
+// STA ids are global and 0-based (AP id * stasPerAp + local index). An ns-2
+// trace (ns-2 setdest, BonnMotion, SUMO traceExporter) must be sorted by
+// time; it is read traceLookahead seconds ahead of the simulation, so only
+// one window of its events is in memory and startup cost does not grow
+// with the trace length.
+std::string scenarioFile = "";
+std::string mobilityTrace = ""; // ns-2 trace, also settable without a scenario file
+double traceLookahead = 5.0;    // s of trace events scheduled ahead
+
+struct TrafficProfile
+{
+    std::string dataRate;
+    uint32_t packetSize;
+    double onTime;  // s, 0 = always on
+    double offTime; // s
+};
+
+struct ScenarioTraffic
+{
+    std::string who;
+    TrafficProfile profile;
+};
+std::vector<ScenarioTraffic> scenarioTraffic; // in file order, later lines win
+std::vector<std::pair<std::string, std::string> > scenarioApps; // (who, app spec)
+
+struct ScenarioWaypoint
+{
+    uint32_t sta;
+    double time;
+    Vector position;
+};
+std::vector<ScenarioWaypoint> scenarioWaypoints;
+
+// Read the file; 'set' lines come back as command-line arguments
+std::vector<std::string> LoadScenarioFile(const std::string &path, const std::string &program)
+{
+    std::ifstream in(path.c_str());
+    NS_ABORT_MSG_IF(!in, "Cannot open scenario file " << path);
+    std::vector<std::string> args(1, program);
+    std::string line;
+    for (uint32_t lineNo = 1; std::getline(in, line); ++lineNo) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string keyword;
+        if (!(tokens >> keyword)) {
+            continue;
+        }
+        if (keyword == "set") {
+            std::string name, value;
+            tokens >> name >> std::ws;
+            std::getline(tokens, value);
+            value.erase(value.find_last_not_of(" \t\r") + 1);
+            NS_ABORT_MSG_IF(name.empty() || value.empty(), path << ":" << lineNo << ": expected 'set <option> <value>'");
+            args.push_back("--" + name + "=" + value);
+        } else if (keyword == "traffic") {
+            ScenarioTraffic traffic;
+            traffic.profile.onTime = 0.0;
+            traffic.profile.offTime = 0.0;
+            tokens >> traffic.who >> traffic.profile.dataRate >> traffic.profile.packetSize;
+            NS_ABORT_MSG_IF(!tokens, path << ":" << lineNo << ": expected 'traffic <who> <dataRate> <packetSize>'");
+            tokens >> traffic.profile.onTime >> traffic.profile.offTime;
+            scenarioTraffic.push_back(traffic);
+        } else if (keyword == "app") {
+            std::string who, spec;
+            tokens >> who >> spec;
+            NS_ABORT_MSG_IF(spec.empty(), path << ":" << lineNo << ": expected 'app <who> <app>[@<ac>]'");
+            scenarioApps.push_back(std::make_pair(who, spec));
+        } else if (keyword == "waypoint") {
+            ScenarioWaypoint waypoint;
+            tokens >> waypoint.sta >> waypoint.time >> waypoint.position.x >> waypoint.position.y;
+            NS_ABORT_MSG_IF(!tokens, path << ":" << lineNo << ": expected 'waypoint <sta> <time> <x> <y>'");
+            waypoint.position.z = 0.0;
+            scenarioWaypoints.push_back(waypoint);
+        } else if (keyword == "mobility") {
+            std::string format, file;
+            tokens >> format >> file;
+            NS_ABORT_MSG_IF(format != "ns2" || file.empty(), path << ":" << lineNo << ": expected 'mobility ns2 <file>'");
+            args.push_back("--mobilityTrace=" + file);
+        } else {
+            NS_ABORT_MSG(path << ":" << lineNo << ": unknown keyword '" << keyword << "'");
+        }
+    }
+    return args;
+}
+
+bool ScenarioSelects(const std::string &who, uint32_t sta)
+{
+    if (who == "*") {
+        return true;
+    }
+    if (who.compare(0, 2, "ap") == 0) {
+        return std::strtoul(who.c_str() + 2, 0, 10) == stations[sta].ap + 1;
+    }
+    return who.compare(0, 3, "sta") == 0 && std::strtoul(who.c_str() + 3, 0, 10) == sta;
+}
+
+// Traffic of one STA: the last matching 'traffic' line, else the global options
+TrafficProfile StaTraffic(uint32_t sta)
+{
+    TrafficProfile profile;
+    profile.dataRate = dataRate;
+    profile.packetSize = packetSize;
+    profile.onTime = 0.0;
+    profile.offTime = 0.0;
+    for (size_t i = 0; i < scenarioTraffic.size(); ++i) {
+        if (ScenarioSelects(scenarioTraffic[i].who, sta)) {
+            profile = scenarioTraffic[i].profile;
+        }
+    }
+    return profile;
 }
 
-void ApplyAIDecision(std::string decision, int apNumber)
+// Application of every STA: --appMix round-robin, then the scenario's 'app' lines
+void ResolveStaApps()
 {
-    if (apNumber == 2) {
-        if (decision == "increase_power" && currentTxPower2 < 20.0) {
-            currentTxPower2 += 2.0;
-            NS_LOG_INFO("AI Decision: Increasing AP2 TX power to " << currentTxPower2 << " dBm");
-        } else if (decision == "decrease_power" && currentTxPower2 > 10.0) {
-            currentTxPower2 -= 2.0;
-            NS_LOG_INFO("AI Decision: Decreasing AP2 TX power to " << currentTxPower2 << " dBm");
-        } else if (decision == "increase_power_change_channel") {
-            if (currentTxPower2 < 20.0) {
-                currentTxPower2 += 3.0;
-                NS_LOG_INFO("AI Decision: Aggressive increase AP2 TX power to " << currentTxPower2 << " dBm");
+    std::vector<StaApp> mix = ParseAppMix(appMix);
+    staApps.resize(stations.size());
+    std::fill(acInUse, acInUse + NUM_ACS, false);
+    for (uint32_t sta = 0; sta < stations.size(); ++sta) {
+        staApps[sta] = mix[sta % mix.size()];
+        for (size_t i = 0; i < scenarioApps.size(); ++i) {
+            if (ScenarioSelects(scenarioApps[i].first, sta)) {
+                staApps[sta] = ParseAppSpec(scenarioApps[i].second);
             }
         }
+        acInUse[staApps[sta].ac] = true;
     }
 }
 
-void RecordMetrics(double time)
+// Client of one STA: its application, traffic profile and AC (as IP TOS)
+ApplicationContainer InstallStaClient(uint32_t sta, const OnOffHelper &onoff, Ipv4Address server,
+                                      uint16_t udpPort, uint16_t tcpPort)
 {
-    monitor->CheckForLostPackets();
-    FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats();
+    const StaApp &app = staApps[sta];
+    TrafficProfile traffic = StaTraffic(sta);
+    Ptr<Node> node = stations[sta].node;
+    if (app.app == APP_BULK) {
+        InetSocketAddress remote(server, tcpPort);
+        remote.SetTos(acTos[app.ac]);
+        BulkSendHelper bulk("ns3::TcpSocketFactory", remote);
+        bulk.SetAttribute("MaxBytes", UintegerValue(0));
+        bulk.SetAttribute("SendSize", UintegerValue(traffic.packetSize));
+        return bulk.Install(node);
+    }
     
-    for (FlowMonitor::FlowStatsContainer::const_iterator iter = stats.begin(); 
-         iter != stats.end(); ++iter) {
-        FlowId fid = iter->first;
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(fid);
-        
-        if (t.sourceAddress == Ipv4Address("10.1.3.1") || 
-            t.sourceAddress == Ipv4Address("10.1.5.1")) {
-            
-            // Calculate delta metrics
-            uint64_t curRxBytes = iter->second.rxBytes;
-            uint64_t curTxPackets = iter->second.txPackets;
-            uint64_t curRxPackets = iter->second.rxPackets;
-            Time curDelaySum = iter->second.delaySum;
-            
-            uint64_t rxBytesDelta = 0;
-            uint64_t txPacketsDelta = 0;
-            uint64_t rxPacketsDelta = 0;
-            Time delayDelta = Seconds(0);
-            
-            if (lastRxBytes.find(fid) != lastRxBytes.end()) {
-                rxBytesDelta = (curRxBytes >= lastRxBytes[fid]) ? 
-                    (curRxBytes - lastRxBytes[fid]) : curRxBytes;
-                txPacketsDelta = (curTxPackets >= lastTxPackets[fid]) ? 
-                    (curTxPackets - lastTxPackets[fid]) : curTxPackets;
-                rxPacketsDelta = (curRxPackets >= lastRxPackets[fid]) ? 
-                    (curRxPackets - lastRxPackets[fid]) : curRxPackets;
-                delayDelta = (curDelaySum >= lastDelaySum[fid]) ? 
-                    (curDelaySum - lastDelaySum[fid]) : curDelaySum;
-            } else {
-                rxBytesDelta = curRxBytes;
-                txPacketsDelta = curTxPackets;
-                rxPacketsDelta = curRxPackets;
-                delayDelta = curDelaySum;
+    InetSocketAddress remote(server, udpPort);
+    remote.SetTos(acTos[app.ac]);
+    OnOffHelper client = onoff;
+    client.SetAttribute("Remote", AddressValue(remote));
+    if (app.app == APP_VOIP) {
+        // Brady talk spurts, G.711 payload every 20 ms
+        client.SetAttribute("DataRate", StringValue("64kbps"));
+        client.SetAttribute("PacketSize", UintegerValue(160));
+        client.SetAttribute("OnTime", StringValue("ns3::ExponentialRandomVariable[Mean=0.352]"));
+        client.SetAttribute("OffTime", StringValue("ns3::ExponentialRandomVariable[Mean=0.65]"));
+    } else if (app.app == APP_VBR) {
+        // Frame bursts at twice the mean rate, half the time on
+        client.SetAttribute("DataRate", DataRateValue(DataRate(DataRate(traffic.dataRate).GetBitRate() * 2)));
+        client.SetAttribute("PacketSize", UintegerValue(traffic.packetSize));
+        client.SetAttribute("OnTime", StringValue("ns3::ExponentialRandomVariable[Mean=0.05]"));
+        client.SetAttribute("OffTime", StringValue("ns3::ExponentialRandomVariable[Mean=0.05]"));
+    } else {
+        client.SetAttribute("DataRate", StringValue(traffic.dataRate));
+        client.SetAttribute("PacketSize", UintegerValue(traffic.packetSize));
+        if (traffic.onTime > 0) {
+            std::ostringstream on, off;
+            on << "ns3::ConstantRandomVariable[Constant=" << traffic.onTime << "]";
+            off << "ns3::ConstantRandomVariable[Constant=" << traffic.offTime << "]";
+            client.SetAttribute("OnTime", StringValue(on.str()));
+            client.SetAttribute("OffTime", StringValue(off.str()));
+        }
+    }
+    return client.Install(node);
+}
+
+// Flow -> application and AC, next to the metrics
+void WriteTrafficPlan()
+{
+    std::ofstream out(OutputPath("ftm_traffic.csv").c_str());
+    out << "Flow,App,AC,DataRate,PacketSize\n";
+    for (uint32_t sta = 0; sta < stations.size(); ++sta) {
+        TrafficProfile traffic = StaTraffic(sta);
+        const StaApp &app = staApps[sta];
+        out << stations[sta].label << "," << appNames[app.app] << "," << acNames[app.ac] << ","
+            << (app.app == APP_VOIP ? std::string("64kbps") : traffic.dataRate) << ","
+            << (app.app == APP_VOIP ? 160u : traffic.packetSize) << "\n";
+    }
+}
+
+// Scripted STAs take their path from the scenario instead of the built-in pattern
+std::vector<uint8_t> traceStas; // by STA id: named by the mobility trace
+
+bool ScriptedMobility(uint32_t sta)
+{
+    if (sta < traceStas.size() && traceStas[sta]) {
+        return true;
+    }
+    for (size_t i = 0; i < scenarioWaypoints.size(); ++i) {
+        if (scenarioWaypoints[i].sta == sta) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AddScenarioWaypoints(uint32_t sta, Ptr<WaypointMobilityModel> model)
+{
+    std::vector<ScenarioWaypoint> path;
+    for (size_t i = 0; i < scenarioWaypoints.size(); ++i) {
+        if (scenarioWaypoints[i].sta == sta) {
+            path.push_back(scenarioWaypoints[i]);
+        }
+    }
+    std::stable_sort(path.begin(), path.end(),
+                     [](const ScenarioWaypoint &a, const ScenarioWaypoint &b) { return a.time < b.time; });
+    for (size_t i = 0; i < path.size(); ++i) {
+        model->AddWaypoint(Waypoint(Seconds(path[i].time), path[i].position));
+    }
+}
+
+// One ns-2 trace command; time < 0 for the untimed initial positions
+enum TraceCommand { TRACE_SETDEST, TRACE_SET_X, TRACE_SET_Y, TRACE_SET_Z };
+struct TraceEvent
+{
+    double time;
+    uint32_t sta;
+    TraceCommand command;
+    Vector value; // destination, or the coordinate in x
+    double speed; // m/s (setdest)
+};
+
+std::ifstream traceStream;
+TraceEvent tracePending;
+bool traceHavePending = false;
+uint64_t traceEventsRead = 0;
+
+// Next usable line of the trace:
+//   $node_(K) set X_ <v>
+//   $ns_ at <t> "$node_(K) set X_ <v>"
+//   $ns_ at <t> "$node_(K) setdest <x> <y> <speed>"
+bool ReadTraceEvent(TraceEvent &event)
+{
+    std::string line;
+    while (std::getline(traceStream, line)) {
+        std::replace(line.begin(), line.end(), '"', ' ');
+        std::istringstream tokens(line);
+        std::string word;
+        tokens >> word;
+        event.time = -1.0;
+        if (word == "$ns_") {
+            std::string at;
+            tokens >> at >> event.time >> word;
+            if (at != "at" || !tokens) {
+                continue;
             }
-            
-            double throughput = (rxBytesDelta * 8.0 / 1.0) / 1e6; // Mbps
-            double pdr = (txPacketsDelta > 0) ? 
-                (double)rxPacketsDelta / txPacketsDelta * 100.0 : 0.0;
-            double loss = 100.0 - pdr;
-            double delay = (rxPacketsDelta > 0) ? 
-                (delayDelta.GetSeconds() / rxPacketsDelta) * 1000.0 : 0.0;
-            
-            // Determine which AP/STA pair
-            bool isAP1 = (t.sourceAddress == Ipv4Address("10.1.3.1"));
-            Ptr<Node> apNode = isAP1 ? apNode1 : apNode2;
-            Ptr<Node> staNode = isAP1 ? staNode1 : staNode2;
-            double currentPower = isAP1 ? currentTxPower1 : currentTxPower2;
-            
-            // Calculate distance and RSSI
-            double distance = CalculateDistance(apNode, staNode);
-            double rssi = CalculateRSSI(distance, currentPower);
-            
-            // AI Decision (only for AP2/STA2)
-            std::string aiDecision = "maintain";
-            if (!isAP1) {
-                aiDecision = ExecuteAIDecision(distance, throughput, rssi);
-                ApplyAIDecision(aiDecision, 2);
+        }
+        unsigned node;
+        std::string command;
+        if (std::sscanf(word.c_str(), "$node_(%u)", &node) != 1 || !(tokens >> command)) {
+            continue;
+        }
+        event.sta = node;
+        if (command == "setdest") {
+            event.command = TRACE_SETDEST;
+            event.value.z = 0.0;
+            tokens >> event.value.x >> event.value.y >> event.speed;
+        } else if (command == "set") {
+            std::string axis;
+            tokens >> axis >> event.value.x;
+            if (axis != "X_" && axis != "Y_" && axis != "Z_") {
+                continue;
             }
-            
-            // Write to CSV
-            csvOutput << (int)time << ","
-                      << (isAP1 ? "AP1-STA1" : "AP2-STA2") << ","
-                      << std::fixed << std::setprecision(2) << distance << ","
-                      << std::fixed << std::setprecision(3) << throughput << ","
-                      << std::fixed << std::setprecision(2) << pdr << ","
-                      << std::fixed << std::setprecision(2) << loss << ","
-                      << std::fixed << std::setprecision(3) << delay << ","
-                      << std::fixed << std::setprecision(2) << rssi << ","
-                      << std::fixed << std::setprecision(1) << currentPower << ","
-                      << aiDecision << std::endl;
-            
-            // Update last state
-            lastRxBytes[fid] = curRxBytes;
-            lastTxPackets[fid] = curTxPackets;
-            lastRxPackets[fid] = curRxPackets;
-            lastDelaySum[fid] = curDelaySum;
+            event.command = axis == "X_" ? TRACE_SET_X : (axis == "Y_" ? TRACE_SET_Y : TRACE_SET_Z);
+        } else {
+            continue;
+        }
+        if (tokens) {
+            traceEventsRead++;
+            return true;
         }
     }
-    
-    if (time < 20.0) {
-        Simulator::Schedule(Seconds(1.0), &RecordMetrics, time + 1.0);
+    return false;
+}
+
+void ApplyTraceEvent(TraceEvent event)
+{
+    Ptr<WaypointMobilityModel> model = stations[event.sta].node->GetObject<WaypointMobilityModel>();
+    Vector position = model->GetPosition();
+    model->EndMobility(); // a new command overrides the leg in progress
+    if (event.command == TRACE_SETDEST && event.speed > 0) {
+        Time arrival = Seconds(CalculateDistance(position, event.value) / event.speed);
+        model->AddWaypoint(Waypoint(Simulator::Now(), position));
+        model->AddWaypoint(Waypoint(Simulator::Now() + arrival, event.value));
+        return;
+    }
+    if (event.command == TRACE_SETDEST) {
+        position = event.value;
+    } else if (event.command == TRACE_SET_X) {
+        position.x = event.value.x;
+    } else if (event.command == TRACE_SET_Y) {
+        position.y = event.value.x;
+    } else {
+        position.z = event.value.x;
+    }
+    model->SetPosition(position);
+}
+
+// Schedule the trace events of the next traceLookahead seconds, then come
+// back for the following window
+void ScheduleTraceWindow()
+{
+    double now = Simulator::Now().GetSeconds();
+    double horizon = now + traceLookahead;
+    while (traceHavePending || ReadTraceEvent(tracePending)) {
+        traceHavePending = true;
+        const TraceEvent &event = tracePending;
+        if (event.time > trafficEnd + 1.0) {
+            break; // past the end of the run
+        }
+        if (event.time >= horizon) {
+            Simulator::Schedule(Seconds(traceLookahead), &ScheduleTraceWindow);
+            return;
+        }
+        traceHavePending = false;
+        if (event.sta >= stations.size()) {
+            continue;
+        }
+        if (event.time < 0) {
+            ApplyTraceEvent(event);
+        } else {
+            NS_ABORT_MSG_IF(event.time < now, "Mobility trace " << mobilityTrace << " is not sorted by time ("
+                            << event.time << " s after " << now << " s)");
+            Simulator::Schedule(Seconds(event.time) - Simulator::Now(), &ApplyTraceEvent, event);
+        }
+    }
+    traceHavePending = false;
+    traceStream.close();
+}
+
+// One pass over the trace before mobility is installed, keeping only which
+// $node_(K) it names: those STAs follow the trace, the rest keep their
+// built-in pattern. The stream is then rewound for ScheduleTraceWindow
+void ScanMobilityTrace()
+{
+    if (mobilityTrace.empty()) {
+        return;
+    }
+    traceStream.open(mobilityTrace.c_str());
+    NS_ABORT_MSG_IF(!traceStream, "Cannot open mobility trace " << mobilityTrace);
+    traceStas.assign(stations.size(), 0);
+    TraceEvent event;
+    while (ReadTraceEvent(event)) {
+        if (event.sta < stations.size()) {
+            traceStas[event.sta] = 1;
+        }
+    }
+    traceStream.clear();
+    traceStream.seekg(0);
+    traceEventsRead = 0;
+}
+
+void SetupMobilityTrace()
+{
+    if (mobilityTrace.empty()) {
+        return;
+    }
+    ScheduleTraceWindow();
+}
+
+// ============== Profile Report ==============
+// Peak resident set size in MiB (ru_maxrss is KiB on Linux)
+double PeakRssMb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_maxrss / 1024.0;
+}
+
+void WriteProfileCounter(std::ostream &out, const char *name, const ProfileCounter &counter, bool last)
+{
+    out << "    \"" << name << "\": {\"seconds\": " << counter.seconds
+        << ", \"calls\": " << counter.calls
+        << ", \"mean_us\": " << (counter.calls ? counter.seconds / counter.calls * 1e6 : 0.0)
+        << "}" << (last ? "\n" : ",\n");
+}
+
+void WriteProfileJson(double setupSeconds, double runSeconds, double serializeSeconds, uint64_t events,
+                      double throughput, double apJoules, double staJoules, double bitsPerJoule)
+{
+    std::ofstream out(OutputPath("ftm_profile.json").c_str());
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"scenario\": {\"numAps\": " << numAps << ", \"stasPerAp\": " << stasPerAp
+        << ", \"simTime\": " << simTime << ", \"sampleInterval\": " << sampleInterval
+        << ", \"collector\": \"" << collector << "\", \"policy\": \"" << policyName
+        << "\", \"appMix\": \"" << appMix << "\", \"latencyPercentiles\": " << (latencyPercentiles ? "true" : "false")
+        << ", \"coordinator\": \"" << coordinator << "\", \"channelMode\": \"" << channelMode << "\", \"ftm\": " << (ftm ? "true" : "false")
+        << ", \"rngRun\": " << firstRun << ", \"systemId\": " << systemId
+        << ", \"systemCount\": " << systemCount << "},\n";
+    out << "  \"wall_seconds\": {\"setup\": " << setupSeconds << ", \"run\": " << runSeconds
+        << ", \"serialize\": " << serializeSeconds
+        << ", \"total\": " << setupSeconds + runSeconds + serializeSeconds << "},\n";
+    out << "  \"events\": " << events << ",\n";
+    out << "  \"events_per_second\": " << (runSeconds > 0 ? events / runSeconds : 0.0) << ",\n";
+    out << "  \"episodes\": " << NumEpisodes() << ",\n";
+    out << "  \"sim_seconds_per_wall_second\": " << (runSeconds > 0 ? (trafficEnd + 1.0) / runSeconds : 0.0) << ",\n";
+    out << "  \"peak_rss_mb\": " << PeakRssMb() << ",\n";
+    out << "  \"aggregate_throughput_mbps\": " << throughput << ",\n";
+    out << "  \"power_actuations\": " << totalActuations << ",\n";
+    if (energy) {
+        out << "  \"energy_joules\": {\"ap\": " << apJoules << ", \"sta\": " << staJoules
+            << ", \"bits_per_joule\": " << bitsPerJoule << "},\n";
     }
+    if (policyName == "bridge") {
+        out << "  \"bridge\": {\"ticks\": " << bridgeTicks << ", \"timeouts\": " << bridgeTimeouts << "},\n";
+    }
+    out << "  \"sections\": {\n";
+    WriteProfileCounter(out, "record_metrics", recordMetricsProfile, false);
+    WriteProfileCounter(out, "decision_engine", decisionProfile, true);
+    out << "  }\n";
+    out << "}\n";
 }
 
 // ============== MAIN ==============
 int main(int argc, char *argv[])
 {
-    CreateResultFolder();
-    
+    ProfileClock::time_point setupStart = ProfileClock::now();
     CommandLine cmd;
+    cmd.AddValue("scenario", "Scenario file (set/traffic/waypoint/mobility lines)", scenarioFile);
+    cmd.AddValue("mobilityTrace", "ns-2 mobility trace for the STAs, streamed during the run", mobilityTrace);
+    cmd.AddValue("traceLookahead", "Mobility trace events scheduled ahead of the simulation (s)", traceLookahead);
+    cmd.AddValue("numAps", "Number of access points (BSSs)", numAps);
+    cmd.AddValue("stasPerAp", "Number of stations associated with each AP", stasPerAp);
+    cmd.AddValue("placement", "AP placement: grid or hex", placement);
+    cmd.AddValue("apSpacing", "Distance between neighbouring APs (m)", apSpacing);
+    cmd.AddValue("staDistance", "Initial distance between a STA and its AP (m)", staDistance);
+    cmd.AddValue("simTime", "Time at which traffic and sampling stop (s)", simTime);
+    cmd.AddValue("sampleInterval", "Interval between metric samples and AI decisions (s)", sampleInterval);
+    cmd.AddValue("adaptiveSampling", "Sample at fastSampleInterval while a mobile STA moves", adaptiveSampling);
+    cmd.AddValue("fastSampleInterval", "Sample interval used while a mobile STA moves (s)", fastSampleInterval);
+    cmd.AddValue("movingSpeed", "Speed above which a STA counts as moving (m/s)", movingSpeed);
+    cmd.AddValue("outputDir", "Directory for all output files (created if missing)", outputDir);
+    cmd.AddValue("dataRate", "OnOff data rate of every STA", dataRate);
+    cmd.AddValue("appMix", "Applications assigned round-robin to the STAs: cbr, vbr, voip, bulk, each [@be|bk|vi|vo]",
+                 appMix);
+    cmd.AddValue("packetSize", "Application packet size (bytes)", packetSize);
+    cmd.AddValue("energy", "Model AP/STA radio energy and add Energy(J), ApEnergy(J), Bits/J columns", energy);
+    cmd.AddValue("latencyPercentiles", "Add per-interval p50/p95/p99 delay and jitter columns per flow", latencyPercentiles);
+    cmd.AddValue("mobileExcursion", "Farthest sideways distance of the mobile STA path (m)", mobileExcursion);
+    cmd.AddValue("targetThroughput", "Controller target throughput (Mbps)", thresholds.targetThroughput);
+    cmd.AddValue("actuation", "Power actuation: direct (every decision, 2 dB) or hysteresis", actuation);
+    cmd.AddValue("hysteresisBand", "Hysteresis: no action within this many Mbps of targetThroughput", hysteresisBand);
+    cmd.AddValue("actuationDwell", "Hysteresis: minimum time between two changes of one AP (s)", actuationDwell);
+    cmd.AddValue("powerStep", "Hysteresis: TX power step per change (dB)", powerStep);
+    cmd.AddValue("slewLimit", "Hysteresis: largest TX power rate of change (dB/s)", slewLimit);
+    cmd.AddValue("coordinator", "Power control: off (per link, mobile BSSs) or joint (one solve per tick, every BSS)",
+                 coordinator);
+    cmd.AddValue("interferenceThreshold", "Joint coordinator: neighbour signal at a starved BSS's STA that counts as interference (dBm)",
+                 interferenceThreshold);
+    cmd.AddValue("farDistance", "Controller: distance that always raises power (m)", thresholds.farDistance);
+    cmd.AddValue("midDistance", "Controller: distance that raises power when throughput drops (m)",
+                 thresholds.midDistance);
+    cmd.AddValue("nearDistance", "Controller: distance below which power may be lowered (m)",
+                 thresholds.nearDistance);
+    cmd.AddValue("weakRssi", "Controller: RSSI that always raises power (dBm)", thresholds.weakRssi);
+    cmd.AddValue("midRssi", "Controller: RSSI that raises power when throughput drops (dBm)",
+                 thresholds.midRssi);
+    cmd.AddValue("strongRssi", "Controller: RSSI above which power may be lowered (dBm)",
+                 thresholds.strongRssi);
+    cmd.AddValue("pcap", "AP packet capture: off, full or header (truncated to pcapSnaplen)", pcapMode);
+    cmd.AddValue("pcapSnaplen", "Bytes kept per frame with --pcap=header", pcapSnaplen);
+    cmd.AddValue("pcapWindows", "Capture windows as start-stop seconds, e.g. 4-6,14-16 (empty = whole run)",
+                 pcapWindows);
+    cmd.AddValue("pcapAps", "Comma-separated AP numbers to capture, e.g. 1,2 (empty = all)", pcapAps);
+    cmd.AddValue("rssiSource", "RSSI for metrics and controller: phy (MonitorSnifferRx), friis (analytic) "
+                 "or logdistance (analytic, the channel's path loss)", rssiSource);
+    cmd.AddValue("pathLossExponent", "LogDistance path loss exponent of the channel and the analytic estimates",
+                 pathLossExponent);
+    cmd.AddValue("rssiEwmaAlpha", "EWMA weight of a new RSSI/SNR sample (0-1]", rssiEwmaAlpha);
+    cmd.AddValue("channelMode", "isolated (no inter-BSS interference) or shared (one medium)", channelMode);
+    cmd.AddValue("channels", "5 GHz channel numbers assigned round-robin to the APs, e.g. 36,40,44", channels);
+    cmd.AddValue("channelDwell", "Minimum seconds between channel switches of one AP", channelDwell);
+    cmd.AddValue("ftm", "Range with FTM bursts instead of ground-truth distance", ftm);
+    cmd.AddValue("ftmBurstsPerSecond", "FTM bursts per AP-STA session per second", ftmBurstsPerSecond);
+    cmd.AddValue("ftmFramesPerBurst", "FTM frames (range samples) per burst", ftmFramesPerBurst);
+    cmd.AddValue("ftmFrameSpacing", "Seconds between the FTM frames of a burst", ftmFrameSpacing);
+    cmd.AddValue("ftmFrameBytes", "FTM action frame body size (bytes)", ftmFrameBytes);
+    cmd.AddValue("ftmRangeStd", "Standard deviation of one FTM range sample (m)", ftmRangeStd);
+    cmd.AddValue("policy", "Power policy: threshold (rules), table (quantized lookup table), model (trained network) "
+                 "or bridge (external agent over shared memory)", policyName);
+    cmd.AddValue("policyTable", "Lookup table file for --policy=table (empty = compile from thresholds)",
+                 policyTable);
+    cmd.AddValue("policyTableOut", "Write the --policy=table lookup table to this file", policyTableOut);
+    cmd.AddValue("policyModel", "Model for --policy=model: ftm-mlp text file or .onnx", policyModel);
+    cmd.AddValue("policyModelInput", "ONNX input tensor name", policyModelInput);
+    cmd.AddValue("policyModelOutput", "ONNX output tensor name", policyModelOutput);
+    cmd.AddValue("bridgeName", "Shared memory name for --policy=bridge", bridgeName);
+    cmd.AddValue("bridgeTimeout", "Per-tick wait for the bridge agent before falling back to the rules (ms)",
+                 bridgeTimeout);
+    cmd.AddValue("bridgeConnectTimeout", "Wait for the bridge agent to attach (s)", bridgeConnectTimeout);
+    cmd.AddValue("flowmonOutput", "FlowMonitor output: xml (full XML at the end), xml-compact (no histograms/probes), "
+                 "jsonl (periodic per-flow lines) or none", flowmonOutput);
+    cmd.AddValue("warmRuns", "Run this many seeds (RngRun, RngRun+1, ...) back to back on one warmed-up setup",
+                 warmRuns);
+    cmd.AddValue("episodeGap", "Seconds of drain between --warmRuns episodes", episodeGap);
+    cmd.AddValue("rolloverInterval", "Long runs: seconds per output part and summary window (0 = one file)",
+                 rolloverInterval);
+    cmd.AddValue("flowmonStreamInterval", "Seconds between jsonl FlowMonitor snapshots", flowmonStreamInterval);
+    cmd.AddValue("netanim", "Write the NetAnim XML trace", netanim);
+    cmd.AddValue("netanimPositionsOnly", "NetAnim: node positions only, no per-packet tracing or metadata",
+                 netanimPositionsOnly);
+    cmd.AddValue("netanimPollInterval", "NetAnim: interval between node position samples (s)",
+                 netanimPollInterval);
+    cmd.AddValue("metricsFormat", "Metrics output: csv or binary (fixed-width records)", metricsFormat);
+    cmd.AddValue("metricsBufferKb", "Metrics output buffer size before a write (KiB)", metricsBufferKb);
+    cmd.AddValue("collector", "Metrics collector: flowmon (poll FlowMonitor), trace (app Tx/Rx traces) or ap (AP IP Rx)",
+                 collector);
+    cmd.AddValue("partition", "Run BSS groups as separate MPI logical processes (mpirun -np N)", partition);
+    // Scenario file first, so every option on the command line overrides it
+    for (int a = 1; a < argc; ++a) {
+        if (std::strncmp(argv[a], "--scenario=", 11) == 0) {
+            cmd.Parse(LoadScenarioFile(argv[a] + 11, argv[0]));
+        }
+    }
     cmd.Parse(argc, argv);
     
+    if (partition) {
+#ifdef NS3_MPI
+        GlobalValue::Bind("SimulatorImplementationType", StringValue("ns3::DistributedSimulatorImpl"));
+        MpiInterface::Enable(&argc, &argv);
+        systemId = MpiInterface::GetSystemId();
+        systemCount = MpiInterface::GetSize();
+        if (Distributed()) {
+            std::ostringstream rankDir;
+            rankDir << outputDir << "/rank-" << systemId;
+            outputDir = rankDir.str();
+        }
+#else
+        NS_ABORT_MSG("--partition needs ns-3 built with MPI (./waf configure --enable-mpi)");
+#endif
+    }
+    NS_ABORT_MSG_IF(Distributed() && collector != "ap",
+                    "Flows cross logical processes with --partition: use --collector=ap");
+    NS_ABORT_MSG_IF(Distributed() && flowmonOutput != "none",
+                    "FlowMonitor only sees one logical process with --partition: use --flowmonOutput=none");
+    NS_ABORT_MSG_IF(Distributed() && channelMode == "shared",
+                    "A shared wireless channel cannot be split across logical processes");
+    NS_ABORT_MSG_IF(Distributed() && netanim, "NetAnim is not supported with --partition");
+    
+    NS_ABORT_MSG_IF(numAps == 0 || stasPerAp == 0, "numAps and stasPerAp must be at least 1");
+    NS_ABORT_MSG_IF(stasPerAp > 250, "stasPerAp must fit in one /24 subnet per BSS");
+    NS_ABORT_MSG_IF(simTime <= 2.0, "simTime must be after the 2 s traffic start");
+    NS_ABORT_MSG_IF(sampleInterval <= 0 || fastSampleInterval <= 0, "Sample intervals must be positive");
+    NS_ABORT_MSG_IF(actuation != "direct" && actuation != "hysteresis",
+                    "Unknown actuation '" << actuation << "' (expected direct or hysteresis)");
+    NS_ABORT_MSG_IF(hysteresisBand < 0 || actuationDwell < 0 || powerStep <= 0 || slewLimit <= 0,
+                    "hysteresisBand and actuationDwell must not be negative, powerStep and slewLimit must be positive");
+    NS_ABORT_MSG_IF(coordinator != "off" && coordinator != "joint",
+                    "Unknown coordinator '" << coordinator << "' (expected off or joint)");
+    NS_ABORT_MSG_IF(collector != "flowmon" && collector != "trace" && collector != "ap",
+                    "Unknown collector '" << collector << "' (expected flowmon, trace or ap)");
+    NS_ABORT_MSG_IF(metricsFormat != "csv" && metricsFormat != "binary",
+                    "Unknown metricsFormat '" << metricsFormat << "' (expected csv or binary)");
+    NS_ABORT_MSG_IF(pcapMode != "off" && pcapMode != "full" && pcapMode != "header",
+                    "Unknown pcap mode '" << pcapMode << "' (expected off, full or header)");
+    NS_ABORT_MSG_IF(flowmonOutput != "xml" && flowmonOutput != "xml-compact" &&
+                    flowmonOutput != "jsonl" && flowmonOutput != "none",
+                    "Unknown flowmonOutput '" << flowmonOutput << "' (expected xml, xml-compact, jsonl or none)");
+    NS_ABORT_MSG_IF(flowmonStreamInterval <= 0, "flowmonStreamInterval must be positive");
+    NS_ABORT_MSG_IF(rolloverInterval < 0, "rolloverInterval must not be negative");
+    NS_ABORT_MSG_IF(episodeGap <= 0, "episodeGap must be positive");
+    NS_ABORT_MSG_IF(traceLookahead <= 0, "traceLookahead must be positive");
+    NS_ABORT_MSG_IF(warmRuns > 0 && (!mobilityTrace.empty() || !scenarioWaypoints.empty()),
+                    "Scenario mobility is not replayed per episode: drop --warmRuns");
+    firstRun = RngSeedManager::GetRun();
+    baseOutputDir = outputDir;
+    episodeEnd = simTime;
+    trafficEnd = simTime + EpisodeOffset(NumEpisodes() - 1);
+    NS_ABORT_MSG_IF(channelMode != "isolated" && channelMode != "shared",
+                    "Unknown channelMode '" << channelMode << "' (expected isolated or shared)");
+    std::vector<std::string> channelList = SplitList(channels, ',');
+    for (size_t c = 0; c < channelList.size(); ++c) {
+        int number = std::atoi(channelList[c].c_str());
+        NS_ABORT_MSG_IF(!Is5GhzChannel(number), "Channel " << channelList[c] << " is not a 5 GHz 20 MHz channel "
+                        "(36-64 and 100-144 in steps of 4, 149-165)");
+        channelPool.push_back((uint8_t)number);
+    }
+    NS_ABORT_MSG_IF(channelPool.empty(), "--channels needs at least one channel number");
+    NS_ABORT_MSG_IF(rssiSource != "phy" && rssiSource != "friis" && rssiSource != "logdistance",
+                    "Unknown rssiSource '" << rssiSource << "' (expected phy, friis or logdistance)");
+    NS_ABORT_MSG_IF(pathLossExponent < 1.0 || pathLossExponent > 6.0,
+                    "pathLossExponent must be within [1, 6] (2 = free space, 3-4 indoor, up to 6 obstructed)");
+    NS_ABORT_MSG_IF(rssiEwmaAlpha <= 0 || rssiEwmaAlpha > 1, "rssiEwmaAlpha must be in (0, 1]");
+    NS_ABORT_MSG_IF(ftm && (ftmBurstsPerSecond <= 0 || ftmFramesPerBurst == 0 ||
+                            (ftmFramesPerBurst + 1) * ftmFrameSpacing >= 1.0 / ftmBurstsPerSecond),
+                    "FTM bursts must fit in the burst period (1/ftmBurstsPerSecond)");
+    NS_ABORT_MSG_IF(policyName != "threshold" && policyName != "table" && policyName != "model" &&
+                    policyName != "bridge",
+                    "Unknown policy '" << policyName << "' (expected threshold, table, model or bridge)");
+    NS_ABORT_MSG_IF(bridgeTimeout <= 0 || bridgeConnectTimeout <= 0, "Bridge timeouts must be positive");
+    NS_ABORT_MSG_IF(placement != "grid" && placement != "hex",
+                    "Unknown placement '" << placement << "' (expected grid or hex)");
+    
+    CreateResultFolder();
+    SetupPowerPolicy();
+    
     // Enable logging
     LogComponentEnable("FTMAdaptiveWiFi", LOG_LEVEL_INFO);
     
     NodeContainer allNodes;
+    NodeContainer allStaNodes;
+    NodeContainer allApNodes;
+    bss.resize(numAps);
+    stations.resize(numAps * stasPerAp);
     
-    // ================= WiFi Group 1 (AP1 + STA1 - Static) =================
-    NodeContainer wifiStaNodes1;
-    wifiStaNodes1.Create(1);
-    staNode1 = wifiStaNodes1.Get(0);
-    allNodes.Add(wifiStaNodes1);
-    
-    NodeContainer wifiApNode1;
-    wifiApNode1.Create(1);
-    apNode1 = wifiApNode1.Get(0);
-    allNodes.Add(wifiApNode1);
-    
-    YansWifiChannelHelper channel1;
-    channel1.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-    channel1.AddPropagationLoss("ns3::LogDistancePropagationLossModel",
-                                "Exponent", DoubleValue(3.0),
-                                "ReferenceDistance", DoubleValue(1.0));
-    
-    phy1_global = YansWifiPhyHelper();
-    phy1_global.SetChannel(channel1.Create());
-    phy1_global.Set("TxPowerStart", DoubleValue(currentTxPower1));
-    phy1_global.Set("TxPowerEnd", DoubleValue(currentTxPower1));
-    
-    WifiHelper wifi1;
-    wifi1.SetStandard(WIFI_PHY_STANDARD_80211n_5GHZ);
-    wifi1.SetRemoteStationManager("ns3::MinstrelHtWifiManager");
-    
-    WifiMacHelper mac1;
-    Ssid ssid1 = Ssid("FTM-AP1-5GHz");
-    mac1.SetType("ns3::StaWifiMac", 
-                 "Ssid", SsidValue(ssid1),
-                 "ActiveProbing", BooleanValue(false));
-    NetDeviceContainer staDevices1 = wifi1.Install(phy1_global, mac1, wifiStaNodes1);
-    
-    mac1.SetType("ns3::ApWifiMac", "Ssid", SsidValue(ssid1));
-    NetDeviceContainer apDevices1 = wifi1.Install(phy1_global, mac1, wifiApNode1);
-    
-    // ================= WiFi Group 2 (AP2 + STA2 - Mobile) =================
-    NodeContainer wifiStaNodes2;
-    wifiStaNodes2.Create(1);
-    staNode2 = wifiStaNodes2.Get(0);
-    allNodes.Add(wifiStaNodes2);
-    
-    NodeContainer wifiApNode2;
-    wifiApNode2.Create(1);
-    apNode2 = wifiApNode2.Get(0);
-    allNodes.Add(wifiApNode2);
-    
-    YansWifiChannelHelper channel2;
-    channel2.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
-    channel2.AddPropagationLoss("ns3::LogDistancePropagationLossModel",
-                                "Exponent", DoubleValue(3.0),
-                                "ReferenceDistance", DoubleValue(1.0));
-    
-    phy2_global = YansWifiPhyHelper();
-    phy2_global.SetChannel(channel2.Create());
-    phy2_global.Set("TxPowerStart", DoubleValue(currentTxPower2));
-    phy2_global.Set("TxPowerEnd", DoubleValue(currentTxPower2));
-    
-    WifiHelper wifi2;
-    wifi2.SetStandard(WIFI_PHY_STANDARD_80211n_5GHZ);
-    wifi2.SetRemoteStationManager("ns3::MinstrelHtWifiManager");
-    
-    WifiMacHelper mac2;
-    Ssid ssid2 = Ssid("FTM-AP2-5GHz");
-    mac2.SetType("ns3::StaWifiMac", 
-                 "Ssid", SsidValue(ssid2),
-                 "ActiveProbing", BooleanValue(false));
-    NetDeviceContainer staDevices2 = wifi2.Install(phy2_global, mac2, wifiStaNodes2);
-    
-    mac2.SetType("ns3::ApWifiMac", "Ssid", SsidValue(ssid2));
-    NetDeviceContainer apDevices2 = wifi2.Install(phy2_global, mac2, wifiApNode2);
+    // ================= WiFi BSSs (AP2, AP4, ... carry mobile STAs) =================
+    WifiHelper wifi;
+    wifi.SetStandard(WIFI_PHY_STANDARD_80211n_5GHZ);
+    wifi.SetRemoteStationManager("ns3::MinstrelHtWifiManager");
+    
+    YansWifiPhyHelper phy;
+    phy.Set("TxPowerStart", DoubleValue(initialTxPower));
+    phy.Set("TxPowerEnd", DoubleValue(initialTxPower));
+    
+    YansWifiChannelHelper channel;
+    channel.SetPropagationDelay("ns3::ConstantSpeedPropagationDelayModel");
+    channel.AddPropagationLoss("ns3::LogDistancePropagationLossModel",
+                               "Exponent", DoubleValue(pathLossExponent),
+                               "ReferenceDistance", DoubleValue(referenceDistance),
+                               "ReferenceLoss", DoubleValue(referenceLoss));
+    Ptr<YansWifiChannel> sharedChannel;
+    if (channelMode == "shared") {
+        sharedChannel = channel.Create();
+    }
+    
+    for (uint32_t i = 0; i < numAps; ++i) {
+        BssState &b = bss[i];
+        b.firstSta = i * stasPerAp;
+        b.txPower = initialTxPower;
+        b.mobile = (i % 2 == 1);
+        b.channel = channelPool[i % channelPool.size()];
+        b.lastChannelSwitch = Seconds(0);
+        b.channelSwitches = 0;
+        b.lastActuation = Seconds(0);
+        b.actuations = 0;
+        b.boostTick = 0;
+        b.boostNetwork = 0.0;
+        
+        NodeContainer staNodes;
+        staNodes.Create(stasPerAp, BssSystemId(i));
+        allNodes.Add(staNodes);
+        allStaNodes.Add(staNodes);
+        for (uint32_t j = 0; j < stasPerAp; ++j) {
+            stations[b.firstSta + j].node = staNodes.Get(j);
+            stations[b.firstSta + j].ap = i;
+            stations[b.firstSta + j].label = FlowLabel(b.firstSta + j);
+        }
+        
+        NodeContainer apNode;
+        apNode.Create(1, BssSystemId(i));
+        b.apNode = apNode.Get(0);
+        allNodes.Add(apNode);
+        allApNodes.Add(apNode);
+        
+        // Isolated: each BSS gets its own channel object, so BSSs never
+        // interfere. Shared: one medium, BSSs on the same channel number
+        // contend and interfere
+        phy.SetChannel(channelMode == "shared" ? sharedChannel : channel.Create());
+        phy.Set("ChannelNumber", UintegerValue(b.channel));
+        
+        std::ostringstream ssidName;
+        ssidName << "FTM-AP" << i + 1 << "-5GHz";
+        Ssid ssid = Ssid(ssidName.str());
+        
+        WifiMacHelper mac;
+        mac.SetType("ns3::StaWifiMac", 
+                    "Ssid", SsidValue(ssid),
+                    "ActiveProbing", BooleanValue(false));
+        b.staDevices = wifi.Install(phy, mac, staNodes);
+        
+        mac.SetType("ns3::ApWifiMac", "Ssid", SsidValue(ssid));
+        b.apDevice = wifi.Install(phy, mac, apNode);
+        b.apPhy = DynamicCast<WifiNetDevice>(b.apDevice.Get(0))->GetPhy();
+    }
     
     // ================= P2P and CSMA (Backbone) =================
     NodeContainer routerNode;
@@ -300,15 +3717,9 @@ int main(int argc, char *argv[])
     pointToPoint.SetDeviceAttribute("DataRate", StringValue("10Mbps"));
     pointToPoint.SetChannelAttribute("Delay", StringValue("2ms"));
     
-    NodeContainer p2pNodes1;
-    p2pNodes1.Add(wifiApNode1);
-    p2pNodes1.Add(routerNode);
-    NetDeviceContainer p2pDevices1 = pointToPoint.Install(p2pNodes1);
-    
-    NodeContainer p2pNodes2;
-    p2pNodes2.Add(wifiApNode2);
-    p2pNodes2.Add(routerNode.Get(0));
-    NetDeviceContainer p2pDevices2 = pointToPoint.Install(p2pNodes2);
+    for (uint32_t i = 0; i < numAps; ++i) {
+        bss[i].p2pDevices = pointToPoint.Install(bss[i].apNode, routerNode.Get(0));
+    }
     
     NodeContainer csmaNodes;
     csmaNodes.Add(routerNode.Get(0));
@@ -321,157 +3732,307 @@ int main(int argc, char *argv[])
     NetDeviceContainer csmaDevices = csma.Install(csmaNodes);
     
     // ================= Mobility Models =================
-    MobilityHelper mobilitySta1;
-    mobilitySta1.SetPositionAllocator("ns3::GridPositionAllocator",
-                                      "MinX", DoubleValue(25.0),
-                                      "MinY", DoubleValue(20.0),
-                                      "DeltaX", DoubleValue(5.0),
-                                      "DeltaY", DoubleValue(5.0),
-                                      "GridWidth", UintegerValue(1),
-                                      "LayoutType", StringValue("RowFirst"));
-    mobilitySta1.SetMobilityModel("ns3::ConstantPositionMobilityModel");
-    mobilitySta1.Install(wifiStaNodes1);
-    
-    // STA2: Waypoint mobility (5m -> 20m -> 10m)
-    MobilityHelper mobilitySta2;
-    mobilitySta2.SetMobilityModel("ns3::WaypointMobilityModel");
-    mobilitySta2.Install(wifiStaNodes2);
-    
-    Ptr<WaypointMobilityModel> sta2Mobility = 
-        wifiStaNodes2.Get(0)->GetObject<WaypointMobilityModel>();
-    sta2Mobility->AddWaypoint(Waypoint(Seconds(0), Vector(25.0, 40.0, 0)));
-    sta2Mobility->AddWaypoint(Waypoint(Seconds(5), Vector(25.0, 40.0, 0)));
-    sta2Mobility->AddWaypoint(Waypoint(Seconds(10), Vector(25.0, 55.0, 0)));
-    sta2Mobility->AddWaypoint(Waypoint(Seconds(15), Vector(25.0, 55.0, 0)));
-    sta2Mobility->AddWaypoint(Waypoint(Seconds(20), Vector(25.0, 45.0, 0)));
-    
     MobilityHelper mobilityFixed;
     mobilityFixed.SetMobilityModel("ns3::ConstantPositionMobilityModel");
-    mobilityFixed.Install(wifiApNode1);
-    mobilityFixed.Install(wifiApNode2);
-    mobilityFixed.Install(routerNode);
-    mobilityFixed.Install(csmaNodes.Get(1));
     
-    // Set positions
-    Ptr<ConstantPositionMobilityModel> ap1Mob = 
-        wifiApNode1.Get(0)->GetObject<ConstantPositionMobilityModel>();
-    ap1Mob->SetPosition(Vector(20.0, 20.0, 0));
+    // Mobile STAs: waypoint mobility (5m -> 20m -> 10m with the default
+    // 15m excursion), moving sideways relative to the direction they sit in
+    // from their AP
+    MobilityHelper mobilityWaypoint;
+    mobilityWaypoint.SetMobilityModel("ns3::WaypointMobilityModel");
     
-    Ptr<ConstantPositionMobilityModel> ap2Mob = 
-        wifiApNode2.Get(0)->GetObject<ConstantPositionMobilityModel>();
-    ap2Mob->SetPosition(Vector(20.0, 40.0, 0));
+    ScanMobilityTrace();
+    double maxApX = 0.0;
+    double minApY = std::numeric_limits<double>::max();
+    double maxApY = 0.0;
+    for (uint32_t i = 0; i < numAps; ++i) {
+        Vector apPos = ApPosition(i);
+        maxApX = std::max(maxApX, apPos.x);
+        minApY = std::min(minApY, apPos.y);
+        maxApY = std::max(maxApY, apPos.y);
+        
+        mobilityFixed.Install(bss[i].apNode);
+        bss[i].apNode->GetObject<ConstantPositionMobilityModel>()->SetPosition(apPos);
+        
+        for (uint32_t j = 0; j < stasPerAp; ++j) {
+            Ptr<Node> staNode = stations[bss[i].firstSta + j].node;
+            double angle = StaAngle(j);
+            Vector start(apPos.x + staDistance * std::cos(angle),
+                         apPos.y + staDistance * std::sin(angle), 0);
+            
+            if (ScriptedMobility(bss[i].firstSta + j)) {
+                mobilityWaypoint.Install(staNode);
+                mobileStations.push_back(bss[i].firstSta + j);
+                Ptr<WaypointMobilityModel> staMobility = staNode->GetObject<WaypointMobilityModel>();
+                staMobility->SetPosition(start);
+                AddScenarioWaypoints(bss[i].firstSta + j, staMobility);
+                continue;
+            }
+            if (!bss[i].mobile) {
+                mobilityFixed.Install(staNode);
+                staNode->GetObject<ConstantPositionMobilityModel>()->SetPosition(start);
+                continue;
+            }
+            
+            mobilityWaypoint.Install(staNode);
+            mobileStations.push_back(bss[i].firstSta + j);
+            Ptr<WaypointMobilityModel> staMobility = staNode->GetObject<WaypointMobilityModel>();
+            double dx = -std::sin(angle);
+            double dy = std::cos(angle);
+            Vector far(start.x + mobileExcursion * dx, start.y + mobileExcursion * dy, 0);
+            Vector back(start.x + mobileExcursion / 3.0 * dx, start.y + mobileExcursion / 3.0 * dy, 0);
+            for (uint32_t k = 0; k < NumEpisodes(); ++k) {
+                // Later episodes return to the start during the gap before their 2 s mark
+                double offset = EpisodeOffset(k);
+                staMobility->AddWaypoint(Waypoint(Seconds(k == 0 ? 0 : offset + 2.0), start));
+                staMobility->AddWaypoint(Waypoint(Seconds(offset + 5), start));
+                staMobility->AddWaypoint(Waypoint(Seconds(offset + 10), far));
+                staMobility->AddWaypoint(Waypoint(Seconds(offset + 15), far));
+                staMobility->AddWaypoint(Waypoint(Seconds(offset + 20), back));
+            }
+        }
+    }
     
-    Ptr<ConstantPositionMobilityModel> routerMob = 
-        routerNode.Get(0)->GetObject<ConstantPositionMobilityModel>();
-    routerMob->SetPosition(Vector(30.0, 30.0, 0));
+    SetupMobilityTrace();
     
-    Ptr<ConstantPositionMobilityModel> serverMob = 
-        csmaNodes.Get(1)->GetObject<ConstantPositionMobilityModel>();
-    serverMob->SetPosition(Vector(50.0, 30.0, 0));
+    // Router sits east of the AP field, server 20 m further east
+    Vector routerPos(maxApX + 10.0, (minApY + maxApY) / 2.0, 0);
+    Vector serverPos(routerPos.x + 20.0, routerPos.y, 0);
+    mobilityFixed.Install(routerNode);
+    mobilityFixed.Install(csmaNodes.Get(1));
+    routerNode.Get(0)->GetObject<ConstantPositionMobilityModel>()->SetPosition(routerPos);
+    csmaNodes.Get(1)->GetObject<ConstantPositionMobilityModel>()->SetPosition(serverPos);
     
     // ================= Internet Stack and Addressing =================
     InternetStackHelper stack;
     stack.Install(allNodes);
     
+    // One /24 per link in the original order: 10.1.1.0 AP1-router,
+    // 10.1.2.0 server LAN, 10.1.3.0 BSS1, 10.1.4.0 AP2-router, 10.1.5.0 BSS2, ...
     Ipv4AddressHelper address;
     address.SetBase("10.1.1.0", "255.255.255.0");
-    Ipv4InterfaceContainer p2pInterfaces1 = address.Assign(p2pDevices1);
-    
-    address.SetBase("10.1.2.0", "255.255.255.0");
-    Ipv4InterfaceContainer csmaInterfaces = address.Assign(csmaDevices);
-    
-    address.SetBase("10.1.3.0", "255.255.255.0");
-    Ipv4InterfaceContainer staInterfaces1 = address.Assign(staDevices1);
-    Ipv4InterfaceContainer apInterface1 = address.Assign(apDevices1);
-    
-    address.SetBase("10.1.4.0", "255.255.255.0");
-    Ipv4InterfaceContainer p2pInterfaces2 = address.Assign(p2pDevices2);
-    
-    address.SetBase("10.1.5.0", "255.255.255.0");
-    Ipv4InterfaceContainer staInterfaces2 = address.Assign(staDevices2);
-    Ipv4InterfaceContainer apInterface2 = address.Assign(apDevices2);
+    Ipv4InterfaceContainer csmaInterfaces;
+    for (uint32_t i = 0; i < numAps; ++i) {
+        address.Assign(bss[i].p2pDevices);
+        address.NewNetwork();
+        if (i == 0) {
+            csmaInterfaces = address.Assign(csmaDevices);
+            address.NewNetwork();
+        }
+        Ipv4InterfaceContainer staInterfaces = address.Assign(bss[i].staDevices);
+        address.Assign(bss[i].apDevice);
+        address.NewNetwork();
+        
+        for (uint32_t j = 0; j < stasPerAp; ++j) {
+            staByAddress[staInterfaces.GetAddress(j).Get()] = bss[i].firstSta + j;
+        }
+    }
     
     // ================= Applications =================
     uint16_t port = 5000;
+    uint16_t tcpPort = 5001;
     Address serverAddress(InetSocketAddress(csmaInterfaces.GetAddress(1), port));
+    ResolveStaApps();
+    bool bulkTraffic = false;
+    for (uint32_t k = 0; k < staApps.size(); ++k) {
+        bulkTraffic = bulkTraffic || staApps[k].app == APP_BULK;
+    }
+    NS_ABORT_MSG_IF(bulkTraffic && collector != "flowmon", "TCP bulk traffic needs --collector=flowmon");
+    
+    // The trace and ap collectors read send timestamps from a SeqTsSizeHeader,
+    // and so do the latency sketches (the header sits inside the payload)
+    bool traceCollector = (collector == "trace");
+    bool seqTsHeader = (collector != "flowmon") || latencyPercentiles;
     
+    // With --partition every process builds the whole topology but only
+    // installs applications on the nodes it owns
     PacketSinkHelper sinkHelper("ns3::UdpSocketFactory", serverAddress);
-    ApplicationContainer serverApp = sinkHelper.Install(csmaNodes.Get(1));
-    serverApp.Start(Seconds(1.0));
-    serverApp.Stop(Seconds(21.0));
-    
-    // STA1 -> Server (5Mbps)
-    OnOffHelper onoff1("ns3::UdpSocketFactory", serverAddress);
-    onoff1.SetAttribute("DataRate", StringValue("5Mbps"));
-    onoff1.SetAttribute("PacketSize", UintegerValue(1024));
-    onoff1.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
-    onoff1.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
-    ApplicationContainer client1 = onoff1.Install(wifiStaNodes1.Get(0));
-    client1.Start(Seconds(2.0));
-    client1.Stop(Seconds(20.0));
-    
-    // STA2 -> Server (5Mbps)
-    OnOffHelper onoff2("ns3::UdpSocketFactory", serverAddress);
-    onoff2.SetAttribute("DataRate", StringValue("5Mbps"));
-    onoff2.SetAttribute("PacketSize", UintegerValue(1024));
-    onoff2.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
-    onoff2.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
-    ApplicationContainer client2 = onoff2.Install(wifiStaNodes2.Get(0));
-    client2.Start(Seconds(2.0));
-    client2.Stop(Seconds(20.0));
+    sinkHelper.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(seqTsHeader));
+    ApplicationContainer serverApp;
+    if (IsLocal(csmaNodes.Get(1))) {
+        serverApp = sinkHelper.Install(csmaNodes.Get(1));
+        serverApp.Start(Seconds(1.0));
+        serverApp.Stop(Seconds(trafficEnd + 1.0));
+        if (bulkTraffic) {
+            PacketSinkHelper tcpSinkHelper("ns3::TcpSocketFactory", InetSocketAddress(Ipv4Address::GetAny(), tcpPort));
+            ApplicationContainer tcpSink = tcpSinkHelper.Install(csmaNodes.Get(1));
+            tcpSink.Start(Seconds(1.0));
+            tcpSink.Stop(Seconds(trafficEnd + 1.0));
+        }
+    }
+    
+    // Every STA -> Server (5Mbps CBR by default, see --appMix)
+    OnOffHelper onoff("ns3::UdpSocketFactory", serverAddress);
+    onoff.SetAttribute("DataRate", StringValue(dataRate));
+    onoff.SetAttribute("PacketSize", UintegerValue(packetSize));
+    onoff.SetAttribute("OnTime", StringValue("ns3::ConstantRandomVariable[Constant=1]"));
+    onoff.SetAttribute("OffTime", StringValue("ns3::ConstantRandomVariable[Constant=0]"));
+    onoff.SetAttribute("EnableSeqTsSizeHeader", BooleanValue(seqTsHeader));
+    ApplicationContainer clients;
+    std::vector<uint32_t> clientSta; // STA id of each installed client
+    for (uint32_t k = 0; k < stations.size(); ++k) {
+        if (!IsLocal(stations[k].node)) {
+            continue;
+        }
+        clients.Add(InstallStaClient(k, onoff, csmaInterfaces.GetAddress(1), port, tcpPort));
+        clientSta.push_back(k);
+    }
+    clients.Start(Seconds(2.0));
+    clients.Stop(Seconds(trafficEnd));
+    if (MixedTraffic()) {
+        WriteTrafficPlan();
+    }
+    
+    if (collector != "flowmon") {
+        intervalCounters.resize(stations.size());
+        runCounters.resize(stations.size());
+        intervalDirty.resize(stations.size(), 0);
+        dirtyStations.reserve(stations.size());
+        for (uint32_t c = 0; c < clients.GetN(); ++c) {
+            clients.Get(c)->TraceConnectWithoutContext("Tx", MakeBoundCallback(&OnClientTx, clientSta[c]));
+        }
+    }
+    if (latencyPercentiles) {
+        flowLatency.resize(stations.size());
+    }
+    if (latencyPercentiles && collector == "flowmon" && serverApp.GetN() > 0) {
+        serverApp.Get(0)->TraceConnectWithoutContext("RxWithSeqTsSize", MakeCallback(&OnSinkRxLatency));
+    }
+    if (traceCollector) {
+        serverApp.Get(0)->TraceConnectWithoutContext("RxWithSeqTsSize", MakeCallback(&OnSinkRx));
+    } else if (collector == "ap") {
+        for (uint32_t i = 0; i < numAps; ++i) {
+            if (IsLocal(bss[i].apNode)) {
+                bss[i].apNode->GetObject<Ipv4L3Protocol>()->TraceConnectWithoutContext("Rx", MakeCallback(&OnApIpRx));
+            }
+        }
+    }
     
     Ipv4GlobalRoutingHelper::PopulateRoutingTables();
     
+    // ================= Link Quality =================
+    SetupLinkQuality();
+    
+    // ================= FTM Ranging =================
+    SetupFtm(2.0);
+    
+    // ================= Energy =================
+    SetupEnergy();
+    
     // ================= PCAP =================
-    phy1_global.EnablePcap("result/ftm-ap1", apDevices1.Get(0), true, true);
-    phy2_global.EnablePcap("result/ftm-ap2", apDevices2.Get(0), true, true);
+    SetupPcap(phy);
     
     // ================= NetAnim =================
-    AnimationInterface anim("result/ftm-wireless-animation.xml");
-    anim.SetConstantPosition(wifiApNode1.Get(0), 20, 20);
-    anim.SetConstantPosition(routerNode.Get(0), 30, 30);
-    anim.SetConstantPosition(wifiApNode2.Get(0), 20, 40);
-    anim.SetConstantPosition(csmaNodes.Get(1), 50, 30);
-    
-    anim.UpdateNodeDescription(wifiStaNodes1.Get(0), "STA1-Static");
-    anim.UpdateNodeColor(wifiStaNodes1.Get(0), 255, 0, 0);
-    anim.UpdateNodeDescription(wifiStaNodes2.Get(0), "STA2-Mobile");
-    anim.UpdateNodeColor(wifiStaNodes2.Get(0), 0, 255, 255);
-    anim.UpdateNodeDescription(wifiApNode1.Get(0), "AP1");
-    anim.UpdateNodeColor(wifiApNode1.Get(0), 0, 0, 255);
-    anim.UpdateNodeDescription(wifiApNode2.Get(0), "AP2");
-    anim.UpdateNodeColor(wifiApNode2.Get(0), 255, 128, 0);
-    anim.UpdateNodeDescription(routerNode.Get(0), "Router");
-    anim.UpdateNodeColor(routerNode.Get(0), 0, 255, 0);
-    anim.UpdateNodeDescription(csmaNodes.Get(1), "Server");
-    anim.UpdateNodeColor(csmaNodes.Get(1), 255, 255, 0);
-    
-    anim.EnablePacketMetadata(true);
+    // Off by default: the XML trace costs CPU and disk on every packet
+    std::unique_ptr<AnimationInterface> anim;
+    if (netanim) {
+        anim.reset(new AnimationInterface(OutputPath("ftm-wireless-animation.xml")));
+        anim->SetMobilityPollInterval(Seconds(netanimPollInterval));
+        for (uint32_t i = 0; i < numAps; ++i) {
+            Vector apPos = ApPosition(i);
+            anim->SetConstantPosition(bss[i].apNode, apPos.x, apPos.y);
+            std::ostringstream apName;
+            apName << "AP" << i + 1;
+            anim->UpdateNodeDescription(bss[i].apNode, apName.str());
+            if (i % 2 == 0) {
+                anim->UpdateNodeColor(bss[i].apNode, 0, 0, 255);
+            } else {
+                anim->UpdateNodeColor(bss[i].apNode, 255, 128, 0);
+            }
+        }
+        anim->SetConstantPosition(routerNode.Get(0), routerPos.x, routerPos.y);
+        anim->SetConstantPosition(csmaNodes.Get(1), serverPos.x, serverPos.y);
+        
+        for (uint32_t k = 0; k < stations.size(); ++k) {
+            std::ostringstream staName;
+            staName << "STA" << k + 1 << (bss[stations[k].ap].mobile ? "-Mobile" : "-Static");
+            anim->UpdateNodeDescription(stations[k].node, staName.str());
+            if (bss[stations[k].ap].mobile) {
+                anim->UpdateNodeColor(stations[k].node, 0, 255, 255);
+            } else {
+                anim->UpdateNodeColor(stations[k].node, 255, 0, 0);
+            }
+        }
+        anim->UpdateNodeDescription(routerNode.Get(0), "Router");
+        anim->UpdateNodeColor(routerNode.Get(0), 0, 255, 0);
+        anim->UpdateNodeDescription(csmaNodes.Get(1), "Server");
+        anim->UpdateNodeColor(csmaNodes.Get(1), 255, 255, 0);
+        
+        if (netanimPositionsOnly) {
+            // Node positions only, sampled every netanimPollInterval
+            anim->SkipPacketTracing();
+        } else {
+            anim->EnablePacketMetadata(true);
+        }
+    }
     
     // ================= Flow Monitor =================
-    monitor = flowmonHelper.InstallAll();
-    classifier = DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier());
+    if (flowmonOutput != "xml") {
+        // Nobody reads the histograms: one bin each keeps per-flow memory flat
+        flowmonHelper.SetMonitorAttribute("DelayBinWidth", DoubleValue(1e6));
+        flowmonHelper.SetMonitorAttribute("JitterBinWidth", DoubleValue(1e6));
+        flowmonHelper.SetMonitorAttribute("PacketSizeBinWidth", DoubleValue(1e6));
+        flowmonHelper.SetMonitorAttribute("FlowInterruptionsBinWidth", DoubleValue(1e6));
+    }
+    if (!Distributed()) {
+        monitor = flowmonHelper.InstallAll();
+        classifier = DynamicCast<Ipv4FlowClassifier>(flowmonHelper.GetClassifier());
+    }
     
-    // Open CSV file
-    csvOutput.open("result/ftm_metrics.csv");
-    csvOutput << "Time(s),Flow,Distance(m),Throughput(Mbps),PDR(%),Loss(%),"
-              << "Delay(ms),RSSI(dBm),TxPower(dBm),AI_Decision" << std::endl;
+    // Open metrics output (each episode opens its own with --warmRuns)
+    if (warmRuns == 0) {
+        OpenMetricsOutput();
+        OpenWindowOutput(2.0);
+    }
+    OpenFlowStream(2.0);
     
-    // Schedule periodic recording
-    Simulator::Schedule(Seconds(2.0), &RecordMetrics, 2.0);
+    // Schedule periodic recording (the first episode with --warmRuns)
+    if (warmRuns > 0) {
+        for (uint32_t i = 0; i < numAps; ++i) {
+            warmWifiDevices.Add(bss[i].apDevice);
+            warmWifiDevices.Add(bss[i].staDevices);
+        }
+        warmNodes = allNodes;
+        Simulator::Schedule(Seconds(2.0), &BeginEpisode, 0u);
+    } else {
+        lastSampleTime = Seconds(2.0);
+        Simulator::Schedule(Seconds(2.0), &RecordMetrics);
+    }
     
-    Simulator::Stop(Seconds(21.0));
+    Simulator::Stop(Seconds(trafficEnd + 1.0));
     
     NS_LOG_INFO("Starting simulation...");
+    ProfileClock::time_point runStart = ProfileClock::now();
     Simulator::Run();
+    ProfileClock::time_point runEnd = ProfileClock::now();
+    WriteActuationReport();
+    outputDir = baseOutputDir; // run-wide files stay at the top level with --warmRuns
     
     // ================= Final Summary =================
-    monitor->SerializeToXmlFile("result/ftm-flowmon-results.xml", true, true);
-    csvOutput.close();
+    if (flowmonOutput == "xml") {
+        monitor->SerializeToXmlFile(OutputPath("ftm-flowmon-results.xml"), true, true);
+    } else if (flowmonOutput == "xml-compact") {
+        monitor->SerializeToXmlFile(OutputPath("ftm-flowmon-results.xml"), false, false);
+    }
+    CloseFlowStream();
+    CloseWindowOutput();
+    metricsSink->Close();
+    ProfileClock::time_point serializeEnd = ProfileClock::now();
     
     std::cout << "\n=== FTM-based Adaptive WiFi Performance Summary ===\n";
-    std::cout << "Configuration: 802.11n (5GHz), DataRate: 5Mbps, PacketSize: 1024 bytes\n";
-    std::cout << "STA1: Static (5m from AP1) | STA2: Mobile (5m->20m->10m from AP2)\n\n";
+    std::cout << "Configuration: 802.11n (5GHz), DataRate: " << dataRate
+              << ", PacketSize: " << packetSize << " bytes\n";
+    std::cout << "Topology: " << numAps << " AP x " << stasPerAp << " STA (" << placement << ")"
+              << " | AP1, AP3, ...: static STAs | AP2, AP4, ...: mobile STAs (5m->20m->10m)\n";
+    if (!scenarioFile.empty()) {
+        std::cout << "Scenario: " << scenarioFile << " (" << scenarioTraffic.size() << " traffic profiles, "
+                  << scenarioWaypoints.size() << " inline waypoints)\n";
+    }
+    if (!mobilityTrace.empty()) {
+        std::cout << "Mobility trace: " << mobilityTrace << " (" << std::count(traceStas.begin(), traceStas.end(), 1)
+                  << " STAs, " << traceEventsRead << " events streamed, " << traceLookahead << " s lookahead)\n";
+    }
+    std::cout << "\n";
     
     std::cout << std::left
               << std::setw(15) << "Flow"
@@ -480,12 +4041,40 @@ int main(int argc, char *argv[])
               << std::setw(12) << "Loss(%)"
               << std::setw(15) << "Avg Delay(ms)" << std::endl;
     
-    FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats();
+    double aggregateThroughput = 0.0;
+    double deliveredBits = 0.0;
+    double acDelaySum[NUM_ACS] = {0.0, 0.0, 0.0, 0.0};
+    uint64_t acPackets[NUM_ACS] = {0, 0, 0, 0};
+    if (!monitor) {
+        // --partition: this process's STAs from the collector's run totals
+        double activeTime = trafficEnd - 2.0;
+        for (uint32_t sta = 0; sta < stations.size(); ++sta) {
+            const FlowCounters &total = runCounters[sta];
+            if (!IsLocal(stations[sta].node)) {
+                continue;
+            }
+            double throughput = total.rxBytes * 8.0 / activeTime / 1e6;
+            double pdr = total.txPackets > 0 ? (double)total.rxPackets / total.txPackets * 100 : 0;
+            double delay = total.rxPackets > 0 ? total.delaySum.GetSeconds() / total.rxPackets * 1000 : 0;
+            std::cout << std::left
+                      << std::setw(15) << stations[sta].label
+                      << std::setw(18) << std::fixed << std::setprecision(3) << throughput
+                      << std::setw(12) << std::fixed << std::setprecision(2) << pdr
+                      << std::setw(12) << std::fixed << std::setprecision(2) << 100.0 - pdr
+                      << std::setw(15) << std::fixed << std::setprecision(3) << delay
+                      << std::endl;
+            aggregateThroughput += throughput;
+            deliveredBits += total.rxBytes * 8.0;
+            acDelaySum[staApps[sta].ac] += total.delaySum.GetSeconds();
+            acPackets[staApps[sta].ac] += total.rxPackets;
+        }
+    }
+    const FlowMonitor::FlowStatsContainer emptyStats;
+    const FlowMonitor::FlowStatsContainer &stats = monitor ? monitor->GetFlowStats() : emptyStats;
     for (FlowMonitor::FlowStatsContainer::const_iterator iter = stats.begin(); 
          iter != stats.end(); ++iter) {
-        Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow(iter->first);
-        if (t.sourceAddress == Ipv4Address("10.1.3.1") || 
-            t.sourceAddress == Ipv4Address("10.1.5.1")) {
+        const FlowRecord &flow = LookupFlow(iter->first);
+        if (flow.tracked) {
             
             double duration = iter->second.timeLastRxPacket.GetSeconds() - 
                              iter->second.timeFirstTxPacket.GetSeconds();
@@ -497,25 +4086,162 @@ int main(int argc, char *argv[])
             double delay = (iter->second.rxPackets > 0) ? 
                 (iter->second.delaySum.GetSeconds() / iter->second.rxPackets) * 1000 : 0;
             
-            std::string flowName = (t.sourceAddress == Ipv4Address("10.1.3.1")) ? 
-                "AP1-STA1" : "AP2-STA2";
-            
             std::cout << std::left
-                      << std::setw(15) << flowName
+                      << std::setw(15) << flow.label
                       << std::setw(18) << std::fixed << std::setprecision(3) << throughput
                       << std::setw(12) << std::fixed << std::setprecision(2) << pdr
                       << std::setw(12) << std::fixed << std::setprecision(2) << loss
                       << std::setw(15) << std::fixed << std::setprecision(3) << delay
                       << std::endl;
+            aggregateThroughput += throughput;
+            deliveredBits += iter->second.rxBytes * 8.0;
+            acDelaySum[staApps[flow.sta].ac] += iter->second.delaySum.GetSeconds();
+            acPackets[staApps[flow.sta].ac] += iter->second.rxPackets;
+        }
+    }
+    std::cout << "Aggregate network throughput: " << std::fixed << std::setprecision(3)
+              << aggregateThroughput << " Mbps\n";
+    if (MixedTraffic()) {
+        std::cout << "Mean delay per access category:";
+        for (uint32_t c = 0; c < NUM_ACS; ++c) {
+            if (acInUse[c]) {
+                std::cout << " " << acNames[c] << "=" << std::setprecision(3)
+                          << (acPackets[c] ? acDelaySum[c] / acPackets[c] * 1000 : 0.0) << " ms";
+            }
+        }
+        std::cout << "\n";
+    }
+    if (latencyPercentiles) {
+        std::cout << "\nLatency percentiles (ms):\n" << std::left
+                  << std::setw(15) << "Flow"
+                  << std::setw(10) << "Delay p50" << std::setw(10) << "p95" << std::setw(10) << "p99"
+                  << std::setw(12) << "Jitter p50" << std::setw(10) << "p95" << std::setw(10) << "p99" << std::endl;
+        for (uint32_t sta = 0; sta < stations.size(); ++sta) {
+            if (!IsLocal(stations[sta].node)) {
+                continue;
+            }
+            const FlowLatency &latency = flowLatency[sta];
+            std::cout << std::left << std::setw(15) << stations[sta].label << std::fixed << std::setprecision(3)
+                      << std::setw(10) << latency.runDelay.Quantile(0.50) / 1000.0
+                      << std::setw(10) << latency.runDelay.Quantile(0.95) / 1000.0
+                      << std::setw(10) << latency.runDelay.Quantile(0.99) / 1000.0
+                      << std::setw(12) << latency.runJitter.Quantile(0.50) / 1000.0
+                      << std::setw(10) << latency.runJitter.Quantile(0.95) / 1000.0
+                      << std::setw(10) << latency.runJitter.Quantile(0.99) / 1000.0 << std::endl;
+        }
+    }
+    double apJoules = 0.0;
+    double staJoules = 0.0;
+    if (energy) {
+        std::cout << "\nRadio energy (J):\n" << std::left
+                  << std::setw(8) << "BSS" << std::setw(12) << "AP" << std::setw(12) << "STAs" << std::endl;
+        for (uint32_t i = 0; i < numAps; ++i) {
+            if (!IsLocal(bss[i].apNode)) {
+                continue;
+            }
+            double ap = apRadios[i]->GetTotalEnergyConsumption();
+            double stas = 0.0;
+            for (uint32_t j = 0; j < bss[i].staDevices.GetN(); ++j) {
+                stas += staRadios[bss[i].firstSta + j]->GetTotalEnergyConsumption();
+            }
+            std::ostringstream label;
+            label << "AP" << i + 1;
+            std::cout << std::left << std::setw(8) << label.str() << std::fixed << std::setprecision(3)
+                      << std::setw(12) << ap << std::setw(12) << stas << std::endl;
+            apJoules += ap;
+            staJoules += stas;
+        }
+        std::cout << "Network energy efficiency: " << std::setprecision(0)
+                  << (apJoules + staJoules > 0 ? deliveredBits / (apJoules + staJoules) : 0.0) << " bits/J\n";
+    }
+    WriteProfileJson(SecondsBetween(setupStart, runStart), SecondsBetween(runStart, runEnd),
+                     SecondsBetween(runEnd, serializeEnd), Simulator::GetEventCount(), aggregateThroughput,
+                     apJoules, staJoules, apJoules + staJoules > 0 ? deliveredBits / (apJoules + staJoules) : 0.0);
+    
+    if (policyName == "bridge") {
+        std::cout << "\nBridge: " << bridgeTicks << " ticks, " << bridgeTimeouts
+                  << " answered by the fallback rules (timeout " << bridgeTimeout << " ms)\n";
+    }
+    std::cout << "\nPower actuations (" << actuation << "):";
+    for (uint32_t i = 0; i < numAps; ++i) {
+        std::cout << " AP" << i + 1 << "=" << bss[i].actuations;
+    }
+    if (warmRuns > 0) {
+        std::cout << " (last run; " << totalActuations << " over all runs)";
+    }
+    std::cout << "\n";
+    
+    if (channelMode == "shared") {
+        std::cout << "\nShared channel plan (final channel, switches" << (warmRuns > 0 ? " in the last run" : "") << "):";
+        for (uint32_t i = 0; i < numAps; ++i) {
+            std::cout << " AP" << i + 1 << "=" << (uint32_t)bss[i].channel
+                      << "(" << bss[i].channelSwitches << ")";
+        }
+        std::cout << "\n";
+    }
+    
+    if (ftm) {
+        std::cout << "\nFTM ranging: " << ftmBurstsPerSecond << " bursts/s x " << ftmFramesPerBurst
+                  << " frames, sample error std " << ftmRangeStd << " m\n";
+        std::cout << std::left
+                  << std::setw(15) << "Flow"
+                  << std::setw(12) << "Frames Tx"
+                  << std::setw(12) << "Frames Rx"
+                  << std::setw(15) << "Airtime(%)"
+                  << std::setw(15) << "Range RMSE(m)" << std::endl;
+        double activeTime = trafficEnd - 2.0;
+        for (uint32_t sta = 0; sta < stations.size(); ++sta) {
+            const FtmSession &session = ftmSessions[sta];
+            double rmse = session.bursts ? std::sqrt(session.errorSq / session.bursts) : 0.0;
+            std::cout << std::left
+                      << std::setw(15) << stations[sta].label
+                      << std::setw(12) << session.framesTx
+                      << std::setw(12) << session.framesRx
+                      << std::setw(15) << std::fixed << std::setprecision(3)
+                      << session.totalAirtime.GetSeconds() / activeTime * 100.0
+                      << std::setw(15) << std::fixed << std::setprecision(3) << rmse
+                      << std::endl;
         }
     }
     
-    std::cout << "\nResults saved to 'result/' folder:\n";
-    std::cout << "  - ftm_metrics.csv (detailed metrics per second)\n";
-    std::cout << "  - ftm-wireless-animation.xml (NetAnim visualization)\n";
-    std::cout << "  - ftm-flowmon-results.xml (FlowMonitor statistics)\n";
-    std::cout << "  - ftm-ap1-*.pcap and ftm-ap2-*.pcap (packet captures)\n\n";
+    std::cout << "\nResults saved to '" << outputDir << "/' folder:\n";
+    if (warmRuns > 0) {
+        std::cout << "  - run-<RngRun>/ (metrics of each of the " << NumEpisodes() << " warm-start episodes)\n";
+    }
+    if (rolloverInterval > 0) {
+        std::cout << "  - ftm_metrics-NNNNN." << (metricsFormat == "binary" ? "bin" : "csv")
+                  << " (detailed metrics, " << outputPart + 1 << " parts of " << rolloverInterval << " s)\n";
+        std::cout << "  - ftm_windows.csv (per-flow summary of every window)\n";
+    } else {
+        std::cout << "  - ftm_metrics." << (metricsFormat == "binary" ? "bin" : "csv")
+                  << " (detailed metrics per sample interval)\n";
+    }
+    if (netanim) {
+        std::cout << "  - ftm-wireless-animation.xml (NetAnim visualization)\n";
+    }
+    if (flowmonOutput == "xml" || flowmonOutput == "xml-compact") {
+        std::cout << "  - ftm-flowmon-results.xml (FlowMonitor statistics)\n";
+    } else if (flowmonOutput == "jsonl") {
+        std::cout << "  - ftm-flowmon-stream.jsonl (FlowMonitor snapshots)\n";
+    }
+    std::cout << "  - ftm_actuations.csv (power/channel changes per AP)\n";
+    if (MixedTraffic()) {
+        std::cout << "  - ftm_traffic.csv (application and access category of each flow)\n";
+    }
+    std::cout << "  - ftm_profile.json (wall time, events/s, peak RSS)\n";
+    if (Distributed()) {
+        std::cout << "  (logical process " << systemId << " of " << systemCount << ": its own BSSs only)\n";
+    }
+    if (pcapMode != "off") {
+        std::cout << "  - ftm-ap<N>-*.pcap (packet captures, one per selected AP)\n";
+    }
+    std::cout << "\n";
     
     Simulator::Destroy();
+#ifdef NS3_MPI
+    if (partition) {
+        MpiInterface::Disable();
+    }
+#endif
     return 0;
 }
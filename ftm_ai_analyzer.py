@@ -9,18 +9,91 @@ import matplotlib.pyplot as plt
 import numpy as np
 import os
 import sys
+import json
+import struct
 from datetime import datetime
 
+METRICS_MAGIC = b"FTMMETR1"
+
+def load_binary_metrics(path):
+    """Memory-map a ftm_metrics.bin file written with --metricsFormat=binary"""
+    with open(path, 'rb') as f:
+        if f.read(8) != METRICS_MAGIC:
+            raise ValueError(f"{path} is not an FTM binary metrics file")
+        version, schema_len = struct.unpack('<II', f.read(8))
+        schema = json.loads(f.read(schema_len).decode('utf-8'))
+    
+    offset = 16 + schema_len
+    dtype = np.dtype([(col['name'], col['type']) for col in schema['columns']])
+    count = (os.path.getsize(path) - offset) // dtype.itemsize
+    if count > 0:
+        records = np.memmap(path, dtype=dtype, mode='r', offset=offset, shape=(count,))
+    else:
+        records = np.zeros(0, dtype=dtype)
+    
+    df = pd.DataFrame({name: records[name] for name in dtype.names})
+    df['Flow'] = np.array(schema['labels'])[records['Flow']]
+    df['AI_Decision'] = np.array(schema['decisions'])[records['AI_Decision']]
+    return df
+
+def load_metrics(path):
+    """Load metrics from CSV, or from the binary record file (.bin)"""
+    if path.endswith('.bin'):
+        return load_binary_metrics(path)
+    return pd.read_csv(path)
+
+# Action order of the simulator's PowerAction enum (--policy=model outputs)
+POWER_ACTIONS = ['maintain', 'increase_power', 'decrease_power', 'increase_power_change_channel']
+
+# Model feature name -> metrics column
+MODEL_FEATURES = [('distance', 'Distance(m)'), ('rssi', 'RSSI(dBm)'),
+                  ('throughput', 'Throughput(Mbps)'), ('pdr', 'PDR(%)'),
+                  ('delay', 'Delay(ms)'), ('txPower', 'TxPower(dBm)')]
+
+def write_policy_model(path, mean, std, layers):
+    """Write an ftm-mlp v1 file; layers = [(weights[out, in], bias[out], activation)]"""
+    with open(path, 'w') as f:
+        f.write("ftm-mlp 1\n")
+        f.write("# outputs: " + " ".join(POWER_ACTIONS) + "\n")
+        f.write("features " + " ".join(name for name, _ in MODEL_FEATURES) + "\n")
+        f.write("normalize " + " ".join(f"{m:.6g} {s:.6g}" for m, s in zip(mean, std)) + "\n")
+        for weights, bias, activation in layers:
+            f.write(f"layer {weights.shape[1]} {weights.shape[0]} {activation}\n")
+            for row in weights:
+                f.write(" ".join(f"{w:.6g}" for w in row) + "\n")
+            f.write(" ".join(f"{b:.6g}" for b in bias) + "\n")
+
+def read_coordinator(run_dir):
+    """--coordinator of the run from its ftm_profile.json ('off' when absent)"""
+    path = os.path.join(run_dir, 'ftm_profile.json')
+    if os.path.exists(path):
+        with open(path) as f:
+            return json.load(f).get('scenario', {}).get('coordinator', 'off')
+    return 'off'
+
+def controlled_flows(flows, coordinator):
+    """Mask of the rows whose BSS ran the controller: mobile BSSs (AP2, AP4, ...) or
+    every BSS with --coordinator=joint; static BSS rows are logged as 'maintain'
+    without a decision ever being computed"""
+    if coordinator == 'joint':
+        return pd.Series(True, index=flows.index)
+    ap = flows.astype(str).str.extract(r'^AP(\d+)-', expand=False).astype(float)
+    return (ap % 2 == 0).fillna(False)
+
 class FTMAnalyzer:
     def __init__(self, csv_path="result/ftm_metrics.csv"):
-        """Initialize analyzer with CSV data"""
+        """Initialize analyzer with CSV (or binary) metrics data"""
+        binary_path = os.path.splitext(csv_path)[0] + '.bin'
+        if not os.path.exists(csv_path) and os.path.exists(binary_path):
+            csv_path = binary_path
         if not os.path.exists(csv_path):
             print(f"Error: {csv_path} not found!")
             print("Please run the NS-3 simulation first.")
             sys.exit(1)
         
-        self.df = pd.read_csv(csv_path)
+        self.df = load_metrics(csv_path)
         self.output_dir = "result"
+        self.coordinator = read_coordinator(os.path.dirname(os.path.abspath(csv_path)))
         
         # Separate data by flow
         self.sta1_data = self.df[self.df['Flow'] == 'AP1-STA1'].copy()
@@ -347,6 +420,52 @@ class FTMAnalyzer:
         
         print(f"✓ Saved summary report: {report_path}")
     
+    def export_policy_model(self, path=None, hidden=16, epochs=3000, lr=0.05):
+        """Fit a small MLP to the logged (metrics -> AI_Decision) pairs and export
+        it for --policy=model; replace the labels to train other behaviour"""
+        path = path or os.path.join(self.output_dir, 'ftm_policy_model.txt')
+        # Only rows with a real decision behind the label
+        train = self.df[controlled_flows(self.df['Flow'], self.coordinator)]
+        x = train[[column for _, column in MODEL_FEATURES]].to_numpy(dtype=np.float64)
+        labels = train['AI_Decision'].map({name: i for i, name in enumerate(POWER_ACTIONS)})
+        y = labels.fillna(0).to_numpy(dtype=np.int64)
+        if len(x) == 0:
+            print("No samples, policy model not exported")
+            return None
+        
+        mean = x.mean(axis=0)
+        std = x.std(axis=0)
+        std[std == 0] = 1.0
+        xn = (x - mean) / std
+        onehot = np.eye(len(POWER_ACTIONS))[y]
+        
+        # Full-batch gradient descent with Adam on the cross-entropy loss
+        rng = np.random.default_rng(0)
+        params = [rng.normal(0, 0.5, (hidden, x.shape[1])), np.zeros(hidden),
+                  rng.normal(0, 0.5, (len(POWER_ACTIONS), hidden)), np.zeros(len(POWER_ACTIONS))]
+        moments = [(np.zeros_like(p), np.zeros_like(p)) for p in params]
+        for step in range(1, epochs + 1):
+            w1, b1, w2, b2 = params
+            h = np.maximum(xn @ w1.T + b1, 0)
+            logits = h @ w2.T + b2
+            prob = np.exp(logits - logits.max(axis=1, keepdims=True))
+            prob /= prob.sum(axis=1, keepdims=True)
+            d_logits = (prob - onehot) / len(xn)
+            d_h = (d_logits @ w2) * (h > 0)
+            grads = [d_h.T @ xn, d_h.sum(axis=0), d_logits.T @ h, d_logits.sum(axis=0)]
+            for p, g, (m, v) in zip(params, grads, moments):
+                m *= 0.9
+                m += 0.1 * g
+                v *= 0.999
+                v += 0.001 * g * g
+                p -= lr * (m / (1 - 0.9 ** step)) / (np.sqrt(v / (1 - 0.999 ** step)) + 1e-8)
+        
+        accuracy = (prob.argmax(axis=1) == y).mean() * 100
+        write_policy_model(path, mean, std, [(params[0], params[1], 'relu'),
+                                             (params[2], params[3], 'linear')])
+        print(f"✓ Saved policy model: {path} (training accuracy {accuracy:.1f}%)")
+        return path
+    
     def run_complete_analysis(self):
         """Run complete analysis pipeline"""
         print("\n" + "="*70)
@@ -357,6 +476,7 @@ class FTMAnalyzer:
         self.ai_recommendations()
         self.visualize_results()
         self.export_summary_report()
+        self.export_policy_model()
         
         print("\n" + "="*70)
         print("ANALYSIS COMPLETE")
@@ -365,6 +485,7 @@ class FTMAnalyzer:
         print("  ✓ ftm_analysis.png - Main performance visualization")
         print("  ✓ ai_decision_timeline.png - AI decision timeline")
         print("  ✓ ftm_summary_report.txt - Text summary report")
+        print("  ✓ ftm_policy_model.txt - Model for --policy=model --policyModel=...")
         print("\n")
 
 def main():
@@ -375,7 +496,10 @@ def main():
     print("This tool analyzes NS-3 simulation results and provides")
     print("AI-driven recommendations for WiFi optimization.\n")
     
-    analyzer = FTMAnalyzer()
+    if len(sys.argv) > 1:
+        analyzer = FTMAnalyzer(sys.argv[1])
+    else:
+        analyzer = FTMAnalyzer()
     analyzer.run_complete_analysis()
 
 if __name__ == "__main__":
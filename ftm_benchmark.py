@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+FTM Adaptive WiFi Benchmark
+Scales STA count, AP count, offered load and sample interval against fixed
+seeds and records simulator performance from each run's ftm_profile.json;
+feature variants (PCAP, NetAnim, FlowMonitor output) measure what each costs
+"""
+
+import argparse
+import csv
+import itertools
+import json
+import os
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+from ftm_sweep import find_binary, run_one
+
+# The simulator gives each BSS one /24 subnet (NS_ABORT_MSG_IF(stasPerAp > 250))
+MAX_STAS_PER_AP = 250
+
+# Feature variants on top of the stripped-down base configuration
+BASE_ARGS = ['--pcap=off', '--netanim=false', '--flowmonOutput=none']
+FEATURES = {
+    'base': [],
+    'pcap': ['--pcap=full'],
+    'netanim': ['--netanim=true'],
+    'flowmon-xml': ['--flowmonOutput=xml'],
+    'flowmon-jsonl': ['--flowmonOutput=jsonl'],
+    'all': ['--pcap=full', '--netanim=true', '--flowmonOutput=xml'],
+}
+
+RESULT_FIELDS = ['wall_setup', 'wall_run', 'wall_serialize', 'wall_total', 'events',
+                 'events_per_second', 'sim_speed', 'peak_rss_mb', 'throughput_mbps',
+                 'record_metrics_us', 'decision_us']
+
+
+def split_list(spec):
+    return [v.strip() for v in spec.split(',') if v.strip()]
+
+
+def read_profile(run_dir):
+    """Flatten a run's ftm_profile.json into the RESULT_FIELDS columns"""
+    path = os.path.join(run_dir, 'ftm_profile.json')
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        profile = json.load(f)
+    wall = profile['wall_seconds']
+    sections = profile['sections']
+    return {
+        'wall_setup': wall['setup'], 'wall_run': wall['run'],
+        'wall_serialize': wall['serialize'], 'wall_total': wall['total'],
+        'events': profile['events'], 'events_per_second': profile['events_per_second'],
+        'sim_speed': profile['sim_seconds_per_wall_second'],
+        'peak_rss_mb': profile['peak_rss_mb'],
+        'throughput_mbps': profile['aggregate_throughput_mbps'],
+        'record_metrics_us': sections['record_metrics']['mean_us'],
+        'decision_us': sections['decision_engine']['mean_us'],
+    }
+
+
+def build_points(args):
+    """Grid of (stas, aps, load, interval, feature, seed); STAs are split evenly over APs"""
+    points = []
+    skipped = set()
+    for stas, aps, load, interval, feature, seed in itertools.product(
+            [int(v) for v in split_list(args.stas)], [int(v) for v in split_list(args.aps)],
+            split_list(args.loads), split_list(args.intervals),
+            split_list(args.features), split_list(args.seeds)):
+        if feature not in FEATURES:
+            sys.exit(f"Error: unknown feature '{feature}' (expected {', '.join(FEATURES)})")
+        if stas < aps or stas % aps != 0:
+            continue  # keep the STA count exact
+        if stas // aps > MAX_STAS_PER_AP:
+            skipped.add((stas, aps))
+            continue
+        points.append({'stas': stas, 'aps': aps, 'stasPerAp': stas // aps, 'load': load,
+                       'interval': interval, 'feature': feature, 'seed': seed})
+    for stas, aps in sorted(skipped):
+        print(f"Note: skipping {stas} STA / {aps} AP ({stas // aps} STAs per AP, "
+              f"the simulator allows at most {MAX_STAS_PER_AP})")
+    return points
+
+
+def write_feature_cost(path, rows):
+    """Per grid point: run/total wall time of each feature relative to base"""
+    key_of = lambda r: (r['stas'], r['aps'], r['load'], r['interval'], r['seed'])
+    base = {key_of(r): r for r in rows if r['feature'] == 'base' and r.get('wall_total')}
+    with open(path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['stas', 'aps', 'load', 'interval', 'seed', 'feature',
+                         'extra_wall_run', 'extra_wall_total', 'extra_peak_rss_mb'])
+        for row in rows:
+            ref = base.get(key_of(row))
+            if row['feature'] == 'base' or ref is None or not row.get('wall_total'):
+                continue
+            writer.writerow(list(key_of(row)) + [
+                row['feature'],
+                f"{row['wall_run'] - ref['wall_run']:.4f}",
+                f"{row['wall_total'] - ref['wall_total']:.4f}",
+                f"{row['peak_rss_mb'] - ref['peak_rss_mb']:.2f}"])
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Benchmark ftm-adaptive-wifi simulator performance over a scaling grid',
+        epilog='example: ftm_benchmark.py --ns3-dir ~/ns-3.33 --stas 1,8,64,512 --aps 1,8 '
+               '--features base,pcap,netanim,flowmon-xml')
+    parser.add_argument('--ns3-dir', default='.', help='ns-3.33 root (contains waf)')
+    parser.add_argument('--stas', default='1,2,4,8,16,32,64,128,256,512',
+                        help='total STA counts (split evenly over the APs)')
+    parser.add_argument('--aps', default='1,4,16', help='AP counts')
+    parser.add_argument('--loads', default='1Mbps,5Mbps', help='per-STA offered load (dataRate)')
+    parser.add_argument('--intervals', default='1.0,0.1', help='sample intervals (s)')
+    parser.add_argument('--seeds', default='1', help='fixed RngRun values')
+    parser.add_argument('--features', default='base',
+                        help='feature variants: ' + ', '.join(FEATURES))
+    parser.add_argument('--extra', default='--simTime=10',
+                        help='fixed arguments passed to every run')
+    parser.add_argument('--jobs', type=int, default=1,
+                        help='concurrent runs (>1 skews wall times through contention)')
+    parser.add_argument('--out', default='benchmark', help='benchmark output directory')
+    parser.add_argument('--no-build', action='store_true', help='skip ./waf build')
+    args = parser.parse_args()
+
+    ns3_dir = os.path.abspath(args.ns3_dir)
+    if not args.no_build:
+        if subprocess.call(['./waf', 'build'], cwd=ns3_dir) != 0:
+            sys.exit("Error: ./waf build failed")
+    binary = find_binary(ns3_dir)
+    env = dict(os.environ)
+    env['LD_LIBRARY_PATH'] = os.path.join(ns3_dir, 'build', 'lib') + os.pathsep + env.get('LD_LIBRARY_PATH', '')
+
+    points = build_points(args)
+    out_dir = os.path.abspath(args.out)
+    os.makedirs(out_dir, exist_ok=True)
+    extra_args = args.extra.split()
+    print(f"Benchmark: {len(points)} points on {args.jobs} worker(s) -> {out_dir}")
+
+    rows = []
+    start = time.time()
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        futures = []
+        for index, point in enumerate(points, 1):
+            run_dir = os.path.join(out_dir, f'point-{index:05d}')
+            params = [('numAps', point['aps']), ('stasPerAp', point['stasPerAp']),
+                      ('dataRate', point['load']), ('sampleInterval', point['interval']),
+                      ('RngRun', point['seed'])]
+            run_args = BASE_ARGS + FEATURES[point['feature']] + extra_args
+            futures.append((point, run_dir, pool.submit(run_one, binary, env, run_dir, params, run_args)))
+        for done, (point, run_dir, future) in enumerate(futures, 1):
+            code, wall = future.result()
+            row = dict(point, code=code, process_wall=wall)
+            row.update(read_profile(run_dir))
+            rows.append(row)
+            status = (f"{row.get('events_per_second', 0):.0f} ev/s, {row.get('peak_rss_mb', 0):.0f} MiB"
+                      if code == 0 else f"FAILED ({code})")
+            print(f"  [{done}/{len(points)}] {point['stas']:>4} STA / {point['aps']:>3} AP "
+                  f"{point['load']:>7} {point['interval']:>5}s {point['feature']:<12} {status}")
+
+    results_path = os.path.join(out_dir, 'benchmark.csv')
+    with open(results_path, 'w', newline='') as f:
+        writer = csv.writer(f)
+        columns = ['stas', 'aps', 'stasPerAp', 'load', 'interval', 'feature', 'seed', 'code',
+                   'process_wall'] + RESULT_FIELDS
+        writer.writerow(columns)
+        for row in rows:
+            writer.writerow([row.get(c, '') for c in columns])
+    cost_path = os.path.join(out_dir, 'benchmark_feature_cost.csv')
+    write_feature_cost(cost_path, rows)
+
+    failed = sum(1 for row in rows if row['code'] != 0)
+    print(f"\nCompleted in {time.time() - start:.1f}s ({failed} failed)")
+    print(f"  - {results_path}")
+    print(f"  - {cost_path}")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+FTM Adaptive WiFi Agent Bridge
+Agent side of --policy=bridge: attaches to the simulator's shared memory
+segment, receives every control tick as one batch of link observations and
+answers with one PowerAction per link (ns3-gym style, without sockets)
+"""
+
+import argparse
+import mmap
+import os
+import struct
+import sys
+import time
+
+# Action order of the simulator's PowerAction enum (as in ftm_ai_analyzer.py)
+POWER_ACTIONS = ['maintain', 'increase_power', 'decrease_power', 'increase_power_change_channel']
+
+BRIDGE_MAGIC = 0x424d5446  # "FTMB"
+BRIDGE_VERSION = 2
+# BridgeHeader in ftm-adaptive-wifi.cc (64 bytes)
+HEADER = struct.Struct('<IIIIQQIIdII8x')
+RESPONSE_SEQ_OFFSET = 24
+AGENT_PID_OFFSET = 48
+
+# Per-link fields, in the order the simulator writes them
+FIELDS = ['ap', 'sta', 'distance', 'throughput', 'pdr', 'delay', 'rssi', 'txPower', 'networkThroughput']
+
+# Rules block after the header: the simulator's ThresholdPowerPolicy parameters
+RULES = ['targetThroughput', 'farDistance', 'midDistance', 'nearDistance', 'weakRssi', 'midRssi',
+         'strongRssi', 'maxTxPower', 'channelSwitch']
+
+
+class FtmBridge:
+    """Shared memory mailbox: tick() blocks for the next batch, respond() answers it;
+    rules holds the threshold parameters the simulator runs with"""
+
+    def __init__(self, name='/ftm-bridge', attach_timeout=30.0):
+        path = os.path.join('/dev/shm', name.lstrip('/'))
+        deadline = time.time() + attach_timeout
+        while True:
+            # The simulator writes the magic last, once the segment is sized
+            try:
+                with open(path, 'r+b') as f:
+                    self.mem = mmap.mmap(f.fileno(), 0)
+                if struct.unpack_from('<I', self.mem, 0)[0] == BRIDGE_MAGIC:
+                    break
+                self.mem.close()
+            except (FileNotFoundError, ValueError, struct.error):
+                pass
+            if time.time() > deadline:
+                sys.exit(f"Error: no simulator bridge at {path} (run with --policy=bridge)")
+            time.sleep(0.05)
+        magic, version, self.capacity, self.fields, _, _, _, _, _, _, rules = HEADER.unpack_from(self.mem, 0)
+        if version != BRIDGE_VERSION or self.fields != len(FIELDS) or rules != len(RULES):
+            sys.exit(f"Error: bridge version {version} with {self.fields} fields and {rules} rules "
+                     f"is not supported")
+        self.rules = dict(zip(RULES, struct.unpack_from(f'<{rules}d', self.mem, HEADER.size)))
+        self.obs_offset = HEADER.size + rules * 8
+        self.rows = struct.Struct(f'<{self.capacity * self.fields}d')
+        self.actions_offset = self.obs_offset + self.rows.size
+        self.last_seq = 0
+        struct.pack_into('<I', self.mem, AGENT_PID_OFFSET, os.getpid())
+
+    def tick(self, poll=0.0001):
+        """Wait for the next tick: (sim time, [dict per link]), or None once the run is over"""
+        while True:
+            _, _, _, _, seq, _, count, finished, sim_time, _, _ = HEADER.unpack_from(self.mem, 0)
+            if seq != self.last_seq:
+                break
+            if finished:
+                return None
+            time.sleep(poll)
+        self.last_seq = seq
+        values = struct.unpack_from(f'<{count * self.fields}d', self.mem, self.obs_offset)
+        links = [dict(zip(FIELDS, values[i * self.fields:(i + 1) * self.fields])) for i in range(count)]
+        for link in links:
+            link['ap'] = int(link['ap'])
+            link['sta'] = int(link['sta'])
+        return sim_time, links
+
+    def respond(self, actions):
+        """Answer the last tick with PowerAction codes (ints) or names, one per link"""
+        codes = [POWER_ACTIONS.index(a) if isinstance(a, str) else int(a) for a in actions]
+        struct.pack_into(f'<{len(codes)}i', self.mem, self.actions_offset, *codes)
+        struct.pack_into('<Q', self.mem, RESPONSE_SEQ_OFFSET, self.last_seq)
+
+    def close(self):
+        self.mem.close()
+
+
+class ThresholdAgent:
+    """ThresholdPowerPolicy with the parameters published by the simulator
+    (FtmBridge.rules), so it follows --farDistance, --weakRssi, --channels etc.
+    A pure function of the rules and one link; the simulator applies its
+    network-aware hold to the answer itself"""
+
+    def __init__(self, rules):
+        self.r = rules
+
+    def act(self, link, sim_time=0.0):
+        r = self.r
+        if link['distance'] > r['farDistance'] or link['rssi'] < r['weakRssi']:
+            return self.boost(link)
+        if link['distance'] > r['midDistance'] or link['rssi'] < r['midRssi']:
+            if link['throughput'] < r['targetThroughput'] * 0.9:
+                return self.boost(link)
+        elif (link['distance'] < r['nearDistance'] and link['rssi'] > r['strongRssi'] and
+              link['throughput'] > r['targetThroughput']):
+            return 'decrease_power'
+        return 'maintain'
+
+    def boost(self, link):
+        if self.r['channelSwitch'] and link['txPower'] >= self.r['maxTxPower']:
+            return 'increase_power_change_channel'
+        return 'increase_power'
+
+
+class ModelAgent:
+    """Evaluates an ftm-mlp file from FTMAnalyzer.export_policy_model() in pure Python"""
+
+    def __init__(self, path):
+        tokens = []
+        with open(path) as f:
+            for line in f:
+                tokens += line.split('#', 1)[0].split()
+        if tokens[:2] != ['ftm-mlp', '1'] or tokens[2] != 'features':
+            sys.exit(f"Error: {path} is not an ftm-mlp v1 file")
+        pos = tokens.index('normalize')
+        self.features = tokens[3:pos]
+        pos += 1
+        self.norm = []
+        for _ in self.features:
+            self.norm.append((float(tokens[pos]), float(tokens[pos + 1]) or 1.0))
+            pos += 2
+        self.layers = []
+        while pos < len(tokens):
+            n_in, n_out, activation = int(tokens[pos + 1]), int(tokens[pos + 2]), tokens[pos + 3]
+            pos += 4
+            weights = [[float(w) for w in tokens[pos + r * n_in:pos + (r + 1) * n_in]] for r in range(n_out)]
+            pos += n_in * n_out
+            bias = [float(b) for b in tokens[pos:pos + n_out]]
+            pos += n_out
+            self.layers.append((weights, bias, activation == 'relu'))
+
+    def act(self, link, sim_time=0.0):
+        x = [(link[name] - mean) / std for name, (mean, std) in zip(self.features, self.norm)]
+        for weights, bias, relu in self.layers:
+            x = [sum(w * v for w, v in zip(row, x)) + b for row, b in zip(weights, bias)]
+            if relu:
+                x = [max(v, 0.0) for v in x]
+        return max(range(len(x)), key=x.__getitem__)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Serve power decisions to ftm-adaptive-wifi --policy=bridge',
+        epilog='example: python3 ftm_bridge.py --model result/ftm_policy_model.txt & '
+               './waf --run "ftm-adaptive-wifi --policy=bridge"')
+    parser.add_argument('--name', default='/ftm-bridge', help='shared memory name (--bridgeName)')
+    parser.add_argument('--model', help='ftm-mlp policy file (default: the simulator\'s threshold rules)')
+    parser.add_argument('--attach-timeout', type=float, default=30.0, help='wait for the simulator (s)')
+    args = parser.parse_args()
+
+    bridge = FtmBridge(args.name, args.attach_timeout)
+    agent = ModelAgent(args.model) if args.model else ThresholdAgent(bridge.rules)
+    print(f"Bridge: attached to {args.name} ({bridge.capacity} links max)")
+    ticks = 0
+    while True:
+        step = bridge.tick()
+        if step is None:
+            break
+        sim_time, links = step
+        # Online learners would read the reward (e.g. networkThroughput) here
+        bridge.respond([agent.act(link, sim_time) for link in links])
+        ticks += 1
+    bridge.close()
+    print(f"Bridge: simulation finished after {ticks} ticks")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
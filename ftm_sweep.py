@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""
+FTM Adaptive WiFi Parameter Sweep
+Runs ftm-adaptive-wifi over a grid of parameters as concurrent worker
+processes (one output directory per run) and merges the metrics
+"""
+
+import argparse
+import csv
+import glob
+import itertools
+import math
+import os
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor, as_completed
+
+SCENARIO = "ftm-adaptive-wifi"
+
+# Metrics summarised per config/flow; the optional ones only when the runs wrote them (--energy)
+METRICS = ['Throughput(Mbps)', 'PDR(%)', 'Delay(ms)']
+OPTIONAL_METRICS = ['Energy(J)', 'Bits/J']
+
+# Two-sided 95% Student t quantiles for small sample sizes (df = n - 1)
+T95 = {1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447, 7: 2.365,
+       8: 2.306, 9: 2.262, 10: 2.228, 15: 2.131, 20: 2.086, 30: 2.042}
+
+
+def t95(df):
+    """95% t quantile, falling back to the normal value for large df"""
+    if df in T95:
+        return T95[df]
+    smaller = [k for k in T95 if k < df]
+    return T95[max(smaller)] if df <= 30 else 1.960
+
+
+def parse_values(spec):
+    """'1-100' -> 1..100, 'a,b,c' -> [a, b, c], otherwise a single value"""
+    if ',' in spec:
+        return [v.strip() for v in spec.split(',') if v.strip()]
+    if '-' in spec and not spec.startswith('-'):
+        low, high = spec.split('-', 1)
+        if low.isdigit() and high.isdigit():
+            return [str(v) for v in range(int(low), int(high) + 1)]
+    return [spec]
+
+
+def parse_grid(params):
+    """['RngRun=1-4', 'dataRate=5Mbps,8Mbps'] -> ordered list of (name, values)"""
+    grid = []
+    for param in params:
+        if '=' not in param:
+            sys.exit(f"Error: --param expects name=values, got '{param}'")
+        name, spec = param.split('=', 1)
+        grid.append((name.strip(), parse_values(spec)))
+    return grid
+
+
+def find_binary(ns3_dir):
+    """Locate the built scenario under build/scratch; waf names it
+    ns3.33-ftm-adaptive-wifi-<profile>, the newest build wins when several exist"""
+    scratch = os.path.join(ns3_dir, 'build', 'scratch')
+    candidates = [os.path.join(scratch, SCENARIO), os.path.join(scratch, SCENARIO, SCENARIO)]
+    candidates += glob.glob(os.path.join(scratch, '**', f'ns3*-{SCENARIO}*'), recursive=True)
+    found = [c for c in candidates if os.path.isfile(c) and os.access(c, os.X_OK)]
+    if found:
+        return max(found, key=os.path.getmtime)
+    sys.exit(f"Error: {SCENARIO} binary not found under {ns3_dir}/build/scratch "
+             "(build it first or drop --no-build)")
+
+
+def run_one(binary, env, run_dir, params, extra_args):
+    """Run one configuration; returns (return code, wall seconds)"""
+    os.makedirs(run_dir, exist_ok=True)
+    args = [binary, f"--outputDir={run_dir}"]
+    args += [f"--{name}={value}" for name, value in params]
+    args += extra_args
+    start = time.time()
+    with open(os.path.join(run_dir, 'stdout.txt'), 'w') as out, \
+         open(os.path.join(run_dir, 'stderr.txt'), 'w') as err:
+        code = subprocess.call(args, stdout=out, stderr=err, env=env)
+    return code, time.time() - start
+
+
+def read_metrics(run_dir):
+    """Rows of a run's ftm_metrics.csv (binary output needs the analyzer loader)"""
+    path = os.path.join(run_dir, 'ftm_metrics.csv')
+    if os.path.exists(path):
+        with open(path, newline='') as f:
+            return list(csv.DictReader(f))
+    path = os.path.join(run_dir, 'ftm_metrics.bin')
+    if os.path.exists(path):
+        from ftm_ai_analyzer import load_metrics
+        return load_metrics(path).to_dict('records')
+    return []
+
+
+def merge(out_dir, runs, seed_param):
+    """Write sweep_metrics.csv (all rows) and sweep_summary.csv (per config/flow CI)"""
+    param_names = [name for name, _ in runs[0]['params']] if runs else []
+    config_names = [name for name in param_names if name != seed_param]
+    merged_path = os.path.join(out_dir, 'sweep_metrics.csv')
+    per_config = {}
+    metrics = None
+
+    with open(merged_path, 'w', newline='') as merged:
+        writer = None
+        for run in runs:
+            if run['code'] != 0:
+                continue
+            rows = read_metrics(run['dir'])
+            params = dict(run['params'])
+            config = tuple(params[name] for name in config_names)
+            flow_sums = {}
+            for row in rows:
+                if writer is None:
+                    writer = csv.writer(merged)
+                    writer.writerow(['Run'] + param_names + list(row.keys()))
+                    metrics = METRICS + [m for m in OPTIONAL_METRICS if m in row]
+                writer.writerow([run['id']] + [params[n] for n in param_names] + list(row.values()))
+                acc = flow_sums.setdefault(row['Flow'], [0.0] * len(metrics) + [0])
+                for m, metric in enumerate(metrics):
+                    acc[m] += float(row.get(metric) or 0.0)
+                acc[-1] += 1
+            # One sample per seed: the run-average of each metric
+            for flow, acc in flow_sums.items():
+                per_config.setdefault((config, flow), []).append([v / acc[-1] for v in acc[:-1]])
+
+    summary_path = os.path.join(out_dir, 'sweep_summary.csv')
+    with open(summary_path, 'w', newline='') as summary:
+        writer = csv.writer(summary)
+        header = config_names + ['Flow', 'Seeds']
+        for metric in metrics or METRICS:
+            header += [f'{metric}_mean', f'{metric}_ci95']
+        writer.writerow(header)
+        for (config, flow), samples in sorted(per_config.items()):
+            n = len(samples)
+            row = list(config) + [flow, n]
+            for m in range(len(metrics)):
+                values = [sample[m] for sample in samples]
+                mean = sum(values) / n
+                if n > 1:
+                    std = math.sqrt(sum((v - mean) ** 2 for v in values) / (n - 1))
+                    ci = t95(n - 1) * std / math.sqrt(n)
+                else:
+                    ci = float('nan')
+                row += [f'{mean:.4f}', f'{ci:.4f}']
+            writer.writerow(row)
+    return merged_path, summary_path
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run ftm-adaptive-wifi over a parameter grid in parallel',
+        epilog='example: ftm_sweep.py --ns3-dir ~/ns-3.33 --param RngRun=1-200 '
+               '--param dataRate=5Mbps,8Mbps --param mobileExcursion=10,15,20')
+    parser.add_argument('--ns3-dir', default='.', help='ns-3.33 root (contains waf)')
+    parser.add_argument('--param', action='append', default=[],
+                        help='name=values, values as a,b,c or an integer range 1-100 (repeatable)')
+    parser.add_argument('--extra', default='',
+                        help='fixed arguments passed to every run, e.g. "--numAps=4 --simTime=30"')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='concurrent runs')
+    parser.add_argument('--out', default='sweep', help='sweep output directory')
+    parser.add_argument('--seed-param', default='RngRun',
+                        help='parameter treated as the seed when computing confidence intervals')
+    parser.add_argument('--no-build', action='store_true', help='skip ./waf build')
+    args = parser.parse_args()
+
+    ns3_dir = os.path.abspath(args.ns3_dir)
+    if not args.no_build:
+        # Build once up front; concurrent waf invocations would fight over the lock
+        if subprocess.call(['./waf', 'build'], cwd=ns3_dir) != 0:
+            sys.exit("Error: ./waf build failed")
+    binary = find_binary(ns3_dir)
+
+    env = dict(os.environ)
+    lib_dir = os.path.join(ns3_dir, 'build', 'lib')
+    env['LD_LIBRARY_PATH'] = lib_dir + os.pathsep + env.get('LD_LIBRARY_PATH', '')
+
+    grid = parse_grid(args.param)
+    names = [name for name, _ in grid]
+    combos = list(itertools.product(*[values for _, values in grid])) if grid else [()]
+    out_dir = os.path.abspath(args.out)
+    os.makedirs(out_dir, exist_ok=True)
+    extra_args = args.extra.split()
+
+    runs = []
+    for index, combo in enumerate(combos, 1):
+        run_id = f'run-{index:05d}'
+        runs.append({'id': run_id, 'dir': os.path.join(out_dir, run_id),
+                     'params': list(zip(names, combo)), 'code': None, 'wall': 0.0})
+
+    print(f"Sweep: {len(runs)} runs on {args.jobs} workers -> {out_dir}")
+    start = time.time()
+    with ThreadPoolExecutor(max_workers=args.jobs) as pool:
+        futures = {pool.submit(run_one, binary, env, run['dir'], run['params'], extra_args): run
+                   for run in runs}
+        for done, future in enumerate(as_completed(futures), 1):
+            run = futures[future]
+            run['code'], run['wall'] = future.result()
+            status = 'ok' if run['code'] == 0 else f"FAILED ({run['code']})"
+            print(f"  [{done}/{len(runs)}] {run['id']} {status} {run['wall']:.1f}s")
+
+    with open(os.path.join(out_dir, 'sweep_runs.csv'), 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['Run'] + names + ['ReturnCode', 'WallTime(s)'])
+        for run in runs:
+            writer.writerow([run['id']] + [v for _, v in run['params']] +
+                            [run['code'], f"{run['wall']:.3f}"])
+
+    merged_path, summary_path = merge(out_dir, runs, args.seed_param)
+    failed = sum(1 for run in runs if run['code'] != 0)
+    print(f"\nCompleted in {time.time() - start:.1f}s ({failed} failed)")
+    print(f"  - {merged_path}")
+    print(f"  - {summary_path}")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
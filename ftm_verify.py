@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""
+FTM Adaptive WiFi Golden Output Verification
+Records fixed-seed runs as a baseline (metrics plus wall times), then reruns
+the same configuration and diffs every per-interval metric against it within
+a tolerance, so an optimisation comes with proof that the simulated results
+did not change and with the wall-clock speedup it bought
+"""
+
+import argparse
+import csv
+import json
+import os
+import shutil
+import subprocess
+import sys
+import time
+
+from ftm_sweep import find_binary, read_metrics, run_one
+
+BASELINE_FILE = 'baseline.json'
+KEY_COLUMNS = ('Time(s)', 'Flow')
+EXACT_COLUMNS = ('AI_Decision',)
+# Flags that restore the configuration the shipped ftm_metrics.csv was made
+# with: analytic Friis RSSI (the default is now the PHY-measured one, which
+# moves RSSI and with it AI_Decision)
+REFERENCE_EXTRA = ['--rssiSource=friis']
+
+
+def split_list(spec):
+    return [v.strip() for v in spec.split(',') if v.strip()]
+
+
+def run_wall(run_dir, process_wall):
+    """Simulation wall time of a run: ftm_profile.json's run section, else the process"""
+    path = os.path.join(run_dir, 'ftm_profile.json')
+    if os.path.exists(path):
+        with open(path) as f:
+            return json.load(f)['wall_seconds']['run']
+    return process_wall
+
+
+def run_seed(binary, env, run_dir, seed, extra_args, repeat):
+    """Run one seed 'repeat' times into run_dir; returns (code, fastest run wall, fastest process wall)"""
+    best_run = best_process = None
+    for _ in range(repeat):
+        if os.path.isdir(run_dir):
+            shutil.rmtree(run_dir)
+        code, wall = run_one(binary, env, run_dir, [('RngRun', seed)], extra_args)
+        if code != 0:
+            return code, None, None
+        wall_run = run_wall(run_dir, wall)
+        best_run = wall_run if best_run is None else min(best_run, wall_run)
+        best_process = wall if best_process is None else min(best_process, wall)
+    return 0, best_run, best_process
+
+
+def key_of(row):
+    """(time, flow) of a row; the time compared as a number so '3' and '3.000' match"""
+    return round(float(row['Time(s)']), 6), str(row['Flow'])
+
+
+def compare_metrics(reference, candidate, abs_tol, rel_tol, ignore):
+    """Per-seed diff: {'rows', 'missing', 'extra', 'mismatches', 'worst': {column: (deviation, key)}, 'examples'}"""
+    ref_rows = {key_of(r): r for r in reference}
+    new_rows = {key_of(r): r for r in candidate}
+    ref_columns = list(reference[0].keys()) if reference else []
+    new_columns = list(candidate[0].keys()) if candidate else []
+    columns = [c for c in ref_columns if c in new_columns and c not in KEY_COLUMNS and c not in ignore]
+    result = {'rows': len(ref_rows), 'missing': [], 'extra': [], 'mismatches': 0, 'worst': {},
+              'examples': [], 'ref_only_columns': [c for c in ref_columns if c not in new_columns],
+              'new_only_columns': [c for c in new_columns if c not in ref_columns]}
+
+    for key, ref in ref_rows.items():
+        new = new_rows.get(key)
+        if new is None:
+            result['missing'].append(key)
+            continue
+        for column in columns:
+            a, b = ref[column], new[column]
+            if column in EXACT_COLUMNS:
+                ok, deviation = a == b, 0.0 if a == b else float('inf')
+            else:
+                try:
+                    fa, fb = float(a), float(b)
+                except (TypeError, ValueError):
+                    ok, deviation = a == b, 0.0 if a == b else float('inf')
+                else:
+                    deviation = abs(fa - fb)
+                    ok = deviation <= abs_tol + rel_tol * abs(fa)
+            worst = result['worst'].get(column)
+            if worst is None or deviation > worst[0]:
+                result['worst'][column] = (deviation, key)
+            if not ok:
+                result['mismatches'] += 1
+                if len(result['examples']) < 10:
+                    result['examples'].append((key, column, a, b))
+    result['extra'] = [key for key in new_rows if key not in ref_rows]
+    return result
+
+
+def record(args, binary, env, baseline_dir):
+    """Run every seed into the baseline directory and store its wall times"""
+    os.makedirs(baseline_dir, exist_ok=True)
+    extra_args = args.extra.split() if args.extra is not None else []
+    seeds = split_list(args.seeds)
+    walls = {}
+    for seed in seeds:
+        code, wall_run, process_wall = run_seed(binary, env, os.path.join(baseline_dir, f'seed-{seed}'),
+                                                seed, extra_args, args.repeat)
+        if code != 0:
+            sys.exit(f"Error: seed {seed} failed ({code}) while recording the baseline")
+        walls[seed] = {'run': wall_run, 'process': process_wall}
+        print(f"  seed {seed}: {wall_run:.3f}s")
+    with open(os.path.join(baseline_dir, BASELINE_FILE), 'w') as f:
+        json.dump({'created': time.strftime('%Y-%m-%d %H:%M:%S'), 'binary': binary,
+                   'extra': extra_args, 'seeds': seeds, 'repeat': args.repeat, 'wall_seconds': walls}, f, indent=2)
+    print(f"\nBaseline of {len(seeds)} seed(s) -> {baseline_dir}")
+    return 0
+
+
+def load_baseline(args, baseline):
+    """(extra args, seeds, {seed: reference rows}, {seed: wall} or None) of a baseline dir or CSV file"""
+    if os.path.isfile(baseline):
+        # A single reference ftm_metrics.csv (e.g. the one shipped with the repo): no timing
+        seeds = split_list(args.seeds)[:1]
+        extra_args = args.extra.split() if args.extra is not None else REFERENCE_EXTRA
+        return extra_args, seeds, {seeds[0]: read_metrics_file(baseline)}, None
+    path = os.path.join(baseline, BASELINE_FILE)
+    if not os.path.exists(path):
+        sys.exit(f"Error: {baseline} has no {BASELINE_FILE} (record one with --record)")
+    with open(path) as f:
+        meta = json.load(f)
+    extra_args = args.extra.split() if args.extra is not None else meta['extra']
+    seeds = meta['seeds']
+    rows = {seed: read_metrics(os.path.join(baseline, f'seed-{seed}')) for seed in seeds}
+    walls = {seed: meta['wall_seconds'][seed]['run'] for seed in seeds}
+    return extra_args, seeds, rows, walls
+
+
+def read_metrics_file(path):
+    """Rows of a metrics file given by path (CSV, or binary through the analyzer loader)"""
+    if path.endswith('.bin'):
+        from ftm_ai_analyzer import load_metrics
+        return load_metrics(path).to_dict('records')
+    with open(path, newline='') as f:
+        return list(csv.DictReader(f))
+
+
+def check(args, binary, env, baseline):
+    """Rerun the baseline's seeds and diff them; returns 0 when every seed matches"""
+    extra_args, seeds, reference, base_walls = load_baseline(args, baseline)
+    out_dir = os.path.abspath(args.out)
+    os.makedirs(out_dir, exist_ok=True)
+    ignore = set(split_list(args.ignore))
+    failed = 0
+    new_walls = {}
+    for seed in seeds:
+        run_dir = os.path.join(out_dir, f'seed-{seed}')
+        code, wall_run, _ = run_seed(binary, env, run_dir, seed, extra_args, args.repeat)
+        if code != 0:
+            print(f"  seed {seed}: FAILED ({code})")
+            failed += 1
+            continue
+        new_walls[seed] = wall_run
+        diff = compare_metrics(reference[seed], read_metrics(run_dir), args.abs_tol, args.rel_tol, ignore)
+        ok = diff['rows'] > 0 and not (diff['missing'] or diff['extra'] or diff['mismatches'])
+        failed += 0 if ok else 1
+        print(f"  seed {seed}: {'match' if ok else 'DIFFERS'} ({diff['rows']} rows, "
+              f"{diff['mismatches']} values out of tolerance, {len(diff['missing'])} missing, "
+              f"{len(diff['extra'])} extra)")
+        for key, column, a, b in diff['examples']:
+            print(f"      t={key[0]} {key[1]} {column}: baseline {a} -> {b}")
+        if args.verbose:
+            for column, (deviation, key) in sorted(diff['worst'].items()):
+                print(f"      max |diff| {column:<20} {deviation:.6g} (t={key[0]} {key[1]})")
+        if diff['ref_only_columns'] or diff['new_only_columns']:
+            print(f"      columns only in baseline: {diff['ref_only_columns']}, only in run: {diff['new_only_columns']}")
+
+    print()
+    if base_walls and new_walls:
+        base_total = sum(base_walls[s] for s in new_walls)
+        new_total = sum(new_walls.values())
+        speedup = base_total / new_total if new_total > 0 else float('nan')
+        print(f"Wall clock (simulation): baseline {base_total:.3f}s, now {new_total:.3f}s "
+              f"-> speedup {speedup:.2f}x over {len(new_walls)} seed(s)")
+    else:
+        print("Wall clock: the baseline has no timing (CSV reference), speedup not reported")
+    print(f"Verification {'PASSED' if failed == 0 else 'FAILED'}: "
+          f"{len(seeds) - failed}/{len(seeds)} seed(s) within abs {args.abs_tol:g} + rel {args.rel_tol:g}")
+    return 1 if failed else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Record fixed-seed golden outputs of ftm-adaptive-wifi and verify new builds against them',
+        epilog='example: ftm_verify.py --ns3-dir ~/ns-3.33 --record --baseline golden --seeds 1,2,3 '
+               '--extra="--simTime=20"; (optimise, rebuild) ftm_verify.py --ns3-dir ~/ns-3.33 --baseline golden')
+    parser.add_argument('--ns3-dir', default='.', help='ns-3.33 root (contains waf)')
+    parser.add_argument('--baseline', default='golden',
+                        help='baseline directory (from --record) or a reference ftm_metrics.csv')
+    parser.add_argument('--record', action='store_true', help='record the baseline instead of checking it')
+    parser.add_argument('--seeds', default='1', help='RngRun values to record (a CSV reference uses the first)')
+    parser.add_argument('--extra', default=None,
+                        help='fixed arguments of every run (default when checking: the baseline\'s, '
+                             'or ' + ' '.join(REFERENCE_EXTRA) + ' for a CSV reference)')
+    parser.add_argument('--abs-tol', type=float, default=1e-9, help='absolute tolerance per value')
+    parser.add_argument('--rel-tol', type=float, default=1e-6, help='relative tolerance per value')
+    parser.add_argument('--ignore', default='', help='columns left out of the comparison, e.g. "Delay(ms)"')
+    parser.add_argument('--repeat', type=int, default=1, help='runs per seed, fastest wall time kept')
+    parser.add_argument('--out', default='verify', help='output directory of the checked runs')
+    parser.add_argument('--verbose', action='store_true', help='print the largest deviation of every column')
+    parser.add_argument('--no-build', action='store_true', help='skip ./waf build')
+    args = parser.parse_args()
+
+    ns3_dir = os.path.abspath(args.ns3_dir)
+    if not args.no_build:
+        if subprocess.call(['./waf', 'build'], cwd=ns3_dir) != 0:
+            sys.exit("Error: ./waf build failed")
+    binary = find_binary(ns3_dir)
+    env = dict(os.environ)
+    env['LD_LIBRARY_PATH'] = os.path.join(ns3_dir, 'build', 'lib') + os.pathsep + env.get('LD_LIBRARY_PATH', '')
+
+    baseline = os.path.abspath(args.baseline)
+    if args.record:
+        return record(args, binary, env, baseline)
+    return check(args, binary, env, baseline)
+
+
+if __name__ == "__main__":
+    sys.exit(main())